@@ -1,9 +1,21 @@
 // gotope.cpp — Interpreter with raw buffer tape, scoped identifiers, assignment
 #include <bits/stdc++.h>
 #include <chrono>
-#define TAPE_SIZE 1024
 #define STORAGE int64_t
+#define TAG uint8_t
 #include <cstdint>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 using namespace std;
 union Cast {
     STORAGE i;
@@ -16,26 +28,962 @@ struct Label {
     string name;
     STORAGE tape_index;
     STORAGE depth;
+    STORAGE line = 0; // source line of the declaration
+};
+
+// Growable array living in its own mapping: anonymous while parsing (zero-filled, grown with mremap)
+// and optionally moved to a shared file mapping before running. Large mappings ask for huge pages.
+template <typename T>
+struct Buffer {
+    T* data = nullptr;
+    size_t capacity = 0;
+    int fd = -1;
+    Buffer() = default;
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+    Buffer(Buffer&& o) noexcept : data(o.data), capacity(o.capacity), fd(o.fd) { o.data = nullptr; o.capacity = 0; o.fd = -1; }
+    Buffer& operator=(Buffer&& o) noexcept { if(this!=&o){ release(); swap(data,o.data); swap(capacity,o.capacity); swap(fd,o.fd);} return *this; }
+    ~Buffer(){ release(); }
+    T& operator[](size_t k) { return data[k]; }
+    const T& operator[](size_t k) const { return data[k]; }
+    static size_t pageBytes(size_t n) { size_t page = sysconf(_SC_PAGESIZE); return ((n*sizeof(T)+page-1)/page)*page; }
+    void release() {
+        if(data) munmap(data, pageBytes(capacity));
+        if(fd>=0) close(fd);
+        data = nullptr; capacity = 0; fd = -1;
+    }
+    void hint() {
+        #ifdef MADV_HUGEPAGE
+        if(pageBytes(capacity) >= (2u<<20)) madvise(data, pageBytes(capacity), MADV_HUGEPAGE);
+        #endif
+    }
+    void reserve(size_t n) {
+        if(n <= capacity) return;
+        size_t cap = max(max(n, capacity*2), pageBytes(1)/sizeof(T));
+        size_t bytes = pageBytes(cap);
+        void* mem;
+        if(fd>=0 && ftruncate(fd, bytes)) throw runtime_error("Cannot grow tape file");
+        if(data) mem = mremap(data, pageBytes(capacity), bytes, MREMAP_MAYMOVE);
+        else mem = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, fd>=0?MAP_SHARED:(MAP_PRIVATE|MAP_ANONYMOUS), fd, 0);
+        if(mem == MAP_FAILED) throw runtime_error("Cannot map "+to_string(bytes)+" bytes of tape");
+        data = (T*)mem;
+        capacity = bytes/sizeof(T);
+        hint();
+    }
+    // Map count elements of an open file copy-on-write: the file is never modified and the pages load on demand.
+    void mapPrivate(int f, off_t offset, size_t count) {
+        release();
+        size_t bytes = pageBytes(max<size_t>(count, 1));
+        void* mem = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE, f, offset);
+        if(mem == MAP_FAILED) throw runtime_error("Cannot map image");
+        data = (T*)mem; capacity = bytes/sizeof(T);
+        hint();
+    }
+    // Move the contents to an anonymous shared mapping, visible to processes forked afterwards.
+    void mapShared(size_t used) {
+        size_t bytes = pageBytes(max<size_t>(used, 1));
+        void* mem = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED) throw runtime_error("Cannot map "+to_string(bytes)+" bytes of shared tape");
+        if(data) memcpy(mem, data, used*sizeof(T));
+        release();
+        data = (T*)mem; capacity = bytes/sizeof(T);
+        hint();
+    }
+    // Move the contents to a file mapping so that the tape can be inspected or shared while running.
+    void mapFile(const string& path, size_t used) {
+        int f = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+        if(f<0) throw runtime_error("Cannot open tape file: "+path);
+        size_t cap = max<size_t>(used, 1);
+        size_t bytes = pageBytes(cap);
+        if(ftruncate(f, bytes)) { close(f); throw runtime_error("Cannot size tape file: "+path); }
+        void* mem = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_SHARED, f, 0);
+        if(mem == MAP_FAILED) { close(f); throw runtime_error("Cannot map tape file: "+path); }
+        if(data) memcpy(mem, data, used*sizeof(T));
+        release();
+        data = (T*)mem; capacity = bytes/sizeof(T); fd = f;
+        hint();
+    }
 };
 
 struct Program {
-    STORAGE tape[TAPE_SIZE];
-    STORAGE iscall[TAPE_SIZE];
+    Buffer<STORAGE> tape;
+    Buffer<TAG> iscall; // 0 data, 1 instruction, 2 string handle, 3 array handle, 4 array instruction
     STORAGE tape_pos = 0;
+    string strings; // pool of NUL-terminated string literals, string cells hold their offset
+    // array cells hold an index into arrays, whose values sit contiguously in arrayData
+    struct Array { STORAGE offset, length; uint64_t version; };
+    vector<Array> arrays;
+    Buffer<double> arrayData;
+    STORAGE arrayCells = 0;
     vector<struct Label> labels;
     unordered_map<string,int> lastLabel;
     unordered_map<string,int> streamIds;
     int nextStreamId = 0;
+    void emit(STORAGE value, TAG call) {
+        if((size_t)tape_pos >= tape.capacity) { tape.reserve(tape_pos+1); iscall.reserve(tape_pos+1); }
+        tape[tape_pos] = value;
+        iscall[tape_pos] = call;
+        tape_pos++;
+    }
+    // Name of the latest label pointing at a cell, or its tape index if there is none.
+    string labelOf(STORAGE cell) const {
+        for (size_t k = labels.size(); k-- > 0;) if (labels[k].tape_index == cell && labels[k].name != "__") return labels[k].name;
+        return "@"+to_string(cell);
+    }
+    string_view str(STORAGE handle) const { return string_view(strings.c_str()+handle); }
+    STORAGE newArray(STORAGE length, double fill) {
+        arrayData.reserve(arrayCells+length);
+        if (fill != 0) fill_n(arrayData.data+arrayCells, length, fill);
+        arrays.push_back({arrayCells, length, 0});
+        arrayCells += length;
+        return arrays.size()-1;
+    }
+    double* array(STORAGE handle) const { return arrayData.data+arrays[handle].offset; }
+    void mapFile(const string& path) {
+        tape.mapFile(path, tape_pos);
+        iscall.mapFile(path+".tags", tape_pos);
+    }
+};
+
+// Convergence tolerances (--atol/--rtol): a result within absTol + relTol*max(|old|,|new|) of the old value is
+// still written but does not count as a change. Both zero accepts only bit-identical results.
+static double absTol = 0, relTol = 0;
+static inline bool differs(STORAGE old, STORAGE r) noexcept {
+    if (old == r) return false;
+    if (absTol == 0 && relTol == 0) return true;
+    double a = fromi(old).d, b = fromi(r).d;
+    return !(fabs(a-b) <= absTol+relTol*max(fabs(a), fabs(b)));
+}
+
+// Computes the instruction whose opcode sits at i into its destination zpos and value r.
+// Returns false for instructions that write nothing.
+static inline bool evaluate(const STORAGE* T, STORAGE i, STORAGE& zpos, STORAGE& r) noexcept {
+    STORAGE op = T[i];
+    zpos = i-1;
+    if (op == 0x05) {zpos=T[i+1];r=T[T[i+2]];return true;}
+    double a=fromi(T[T[i+1]]).d, b=fromi(T[T[i+2]]).d;
+    if (op == 0x02) r=fromd(a*b).i;
+    else if (op == 0x03) r=fromd(a+b).i;
+    else if (op == 0x07) r=fromd(pow(a,b)).i;
+    else if (op == 0x08) r=fromd((a<b)?1.0:-1.0).i;
+    else return false;
+    return true;
+}
+
+// Evaluates the instruction at i in place and returns the written cell if its value changed, or -1.
+static inline STORAGE exec(STORAGE* T, STORAGE i) noexcept {
+    STORAGE zpos, r;
+    if (!evaluate(T, i, zpos, r) || T[zpos] == r) return -1;
+    bool changed = differs(T[zpos], r);
+    T[zpos] = r;
+    return changed ? zpos : -1;
+}
+
+// Cells read by the instruction at i (opcodes 0x02/0x03/0x05/0x07/0x08), or {-1,-1} if it reads none.
+static inline pair<STORAGE,STORAGE> sources(const STORAGE* T, STORAGE i) noexcept {
+    STORAGE op = T[i];
+    if (op == 0x05) return {T[i+2], -1};
+    if (op == 0x02 || op == 0x03 || op == 0x07 || op == 0x08) return {T[i+1], T[i+2]};
+    return {-1, -1};
+}
+
+// Structure-of-arrays copy of the instruction stream, grouped by opcode so that each batch runs one tight kernel.
+// Assignments (0x05) keep their lhs in dst and their rhs in a.
+struct Lowered {
+    struct Batch { STORAGE op; vector<STORAGE> dst, a, b; };
+    vector<Batch> batches;
+    // Instructions are grouped by opcode in tape order. An instruction that reads a cell written earlier in its
+    // opcode's open batch, or writes a cell read or written there, starts a new batch for that opcode. No batch then
+    // holds a dependency between its members, so gather-first vector kernels, the scalar kernel and parallel
+    // chunks all compute the same values.
+    void lower(const Program& prog) {
+        static const STORAGE ops[] = {0x02, 0x03, 0x07, 0x08, 0x05};
+        batches.clear();
+        const STORAGE* T = prog.tape.data;
+        vector<uint16_t> mark(prog.tape_pos, 0); // bit s: written by the open batch of ops[s], bit s+5: read by it
+        size_t open[5];
+        for (int s = 0; s < 5; s++) { open[s] = batches.size(); batches.push_back({ops[s], {}, {}, {}}); }
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1) {
+            STORAGE op = T[i];
+            int s = 0;
+            while (s < 5 && ops[s] != op) s++;
+            if (s == 5) continue;
+            STORAGE z = op == 0x05 ? T[i+1] : i-1, a = op == 0x05 ? T[i+2] : T[i+1], b = T[i+2];
+            uint16_t wrote = 1 << s, read = 1 << (s+5);
+            if (((mark[a] | mark[b]) & wrote) || (mark[z] & (wrote | read))) {
+                Batch& done = batches[open[s]];
+                for (size_t k = 0; k < done.dst.size(); k++) { mark[done.dst[k]] &= ~wrote; mark[done.a[k]] &= ~read; mark[done.b[k]] &= ~read; }
+                open[s] = batches.size();
+                batches.push_back({op, {}, {}, {}});
+            }
+            Batch& batch = batches[open[s]];
+            batch.dst.push_back(z); batch.a.push_back(a); batch.b.push_back(b);
+            mark[z] |= wrote; mark[a] |= read; mark[b] |= read;
+        }
+    }
+};
+
+// Batch kernels: gather the operands, compute and write back only the destinations whose value changed.
+typedef bool (*Kernel)(STORAGE op, STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n);
+
+template <STORAGE OP>
+static inline STORAGE compute(STORAGE x, STORAGE y) noexcept {
+    if constexpr (OP == 0x02) return fromd(fromi(x).d*fromi(y).d).i;
+    else if constexpr (OP == 0x03) return fromd(fromi(x).d+fromi(y).d).i;
+    else if constexpr (OP == 0x07) return fromd(pow(fromi(x).d,fromi(y).d)).i;
+    else if constexpr (OP == 0x08) return fromd((fromi(x).d<fromi(y).d)?1.0:-1.0).i;
+    else return x;
+}
+
+template <STORAGE OP>
+static bool batch_scalar(STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n, size_t k = 0) noexcept {
+    bool modified = false;
+    for (; k < n; k++) {
+        STORAGE r = compute<OP>(T[a[k]], T[b[k]]);
+        if (T[dst[k]] != r) { modified |= differs(T[dst[k]], r); T[dst[k]] = r; }
+    }
+    return modified;
+}
+
+static bool kernel_scalar(STORAGE op, STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n) {
+    switch (op) {
+        case 0x02: return batch_scalar<0x02>(T, dst, a, b, n);
+        case 0x03: return batch_scalar<0x03>(T, dst, a, b, n);
+        case 0x07: return batch_scalar<0x07>(T, dst, a, b, n);
+        case 0x08: return batch_scalar<0x08>(T, dst, a, b, n);
+        default: return batch_scalar<0x05>(T, dst, a, b, n);
+    }
+}
+
+#if defined(__x86_64__)
+// There is no vector pow, so ^ always takes the scalar path.
+template <STORAGE OP>
+__attribute__((target("avx2"))) static bool batch_avx2(STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n) noexcept {
+    if constexpr (OP == 0x07) return batch_scalar<OP>(T, dst, a, b, n);
+    else {
+        const double* D = (const double*)T;
+        bool modified = false;
+        size_t k = 0;
+        for (; k+4 <= n; k+=4) {
+            __m256i iz = _mm256_loadu_si256((const __m256i*)(dst+k));
+            __m256d x = _mm256_i64gather_pd(D, _mm256_loadu_si256((const __m256i*)(a+k)), 8);
+            __m256d r;
+            if constexpr (OP == 0x02) r = _mm256_mul_pd(x, _mm256_i64gather_pd(D, _mm256_loadu_si256((const __m256i*)(b+k)), 8));
+            else if constexpr (OP == 0x03) r = _mm256_add_pd(x, _mm256_i64gather_pd(D, _mm256_loadu_si256((const __m256i*)(b+k)), 8));
+            else if constexpr (OP == 0x08) r = _mm256_blendv_pd(_mm256_set1_pd(-1.0), _mm256_set1_pd(1.0), _mm256_cmp_pd(x, _mm256_i64gather_pd(D, _mm256_loadu_si256((const __m256i*)(b+k)), 8), _CMP_LT_OQ));
+            else r = x;
+            __m256i old = _mm256_i64gather_epi64((const long long*)T, iz, 8);
+            int same = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(old, _mm256_castpd_si256(r))));
+            if (same == 0xF) continue;
+            alignas(32) STORAGE lanes[4];
+            _mm256_store_si256((__m256i*)lanes, _mm256_castpd_si256(r));
+            for (int l = 0; l < 4; l++) if (!(same & (1<<l))) T[dst[k+l]] = lanes[l];
+            modified = true;
+        }
+        return batch_scalar<OP>(T, dst, a, b, n, k) || modified;
+    }
+}
+
+// The masked gathers with a zeroed source are the same loads, but leave no lane the compiler thinks uninitialized.
+__attribute__((target("avx512f"))) static inline __m512d gather512(const STORAGE* T, const STORAGE* idx) noexcept {
+    return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xFF, _mm512_loadu_si512(idx), T, 8);
+}
+
+template <STORAGE OP>
+__attribute__((target("avx512f"))) static bool batch_avx512(STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n) noexcept {
+    if constexpr (OP == 0x07) return batch_scalar<OP>(T, dst, a, b, n);
+    else {
+        bool modified = false;
+        size_t k = 0;
+        for (; k+8 <= n; k+=8) {
+            __m512i iz = _mm512_loadu_si512(dst+k);
+            __m512d x = gather512(T, a+k);
+            __m512d r;
+            if constexpr (OP == 0x02) r = _mm512_mul_pd(x, gather512(T, b+k));
+            else if constexpr (OP == 0x03) r = _mm512_add_pd(x, gather512(T, b+k));
+            else if constexpr (OP == 0x08) r = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, gather512(T, b+k), _CMP_LT_OQ), _mm512_set1_pd(-1.0), _mm512_set1_pd(1.0));
+            else r = x;
+            __m512i old = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), 0xFF, iz, T, 8);
+            __mmask8 changed = _mm512_cmpneq_epi64_mask(old, _mm512_castpd_si512(r));
+            if (!changed) continue;
+            _mm512_mask_i64scatter_pd(T, changed, iz, r, 8);
+            modified = true;
+        }
+        return batch_scalar<OP>(T, dst, a, b, n, k) || modified;
+    }
+}
+
+__attribute__((target("avx2"))) static bool kernel_avx2(STORAGE op, STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n) {
+    switch (op) {
+        case 0x02: return batch_avx2<0x02>(T, dst, a, b, n);
+        case 0x03: return batch_avx2<0x03>(T, dst, a, b, n);
+        case 0x07: return batch_avx2<0x07>(T, dst, a, b, n);
+        case 0x08: return batch_avx2<0x08>(T, dst, a, b, n);
+        default: return batch_avx2<0x05>(T, dst, a, b, n);
+    }
+}
+
+__attribute__((target("avx512f"))) static bool kernel_avx512(STORAGE op, STORAGE* T, const STORAGE* dst, const STORAGE* a, const STORAGE* b, size_t n) {
+    switch (op) {
+        case 0x02: return batch_avx512<0x02>(T, dst, a, b, n);
+        case 0x03: return batch_avx512<0x03>(T, dst, a, b, n);
+        case 0x07: return batch_avx512<0x07>(T, dst, a, b, n);
+        case 0x08: return batch_avx512<0x08>(T, dst, a, b, n);
+        default: return batch_avx512<0x05>(T, dst, a, b, n);
+    }
+}
+#endif
+
+// Returns the requested kernel (scalar|avx2|avx512). For auto, times each kernel the cpu supports over a few passes
+// of the batches on a scratch copy of the tape and keeps the fastest; batches hold no internal dependencies, so they
+// all compute the same values.
+static Kernel pickKernel(const string& simd, const Lowered& lowered, const STORAGE* T, STORAGE n) {
+    if (absTol != 0 || relTol != 0) return kernel_scalar; // the vector kernels compare bits only
+    vector<Kernel> candidates = {kernel_scalar};
+    #if defined(__x86_64__)
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2"), avx512 = __builtin_cpu_supports("avx512f");
+    if (simd == "avx2" || simd == "avx512") {
+        if (simd == "avx2" ? !avx2 : !avx512) throw runtime_error("This cpu does not support "+simd);
+        return simd == "avx2" ? kernel_avx2 : kernel_avx512;
+    }
+    if (avx2) candidates.push_back(kernel_avx2);
+    if (avx512) candidates.push_back(kernel_avx512);
+    #endif
+    if (simd != "auto" && simd != "scalar") throw runtime_error("Unknown simd kernel: "+simd);
+    if (simd == "scalar" || candidates.size() == 1) return kernel_scalar;
+    vector<STORAGE> scratch(T, T+n);
+    Kernel best = kernel_scalar;
+    double bestTime = INFINITY;
+    for (Kernel kernel : candidates) {
+        double time = INFINITY;
+        for (int pass = 0; pass < 3; pass++) {
+            auto start = chrono::steady_clock::now();
+            for (auto& batch : lowered.batches)
+                kernel(batch.op, scratch.data(), batch.dst.data(), batch.a.data(), batch.b.data(), batch.dst.size());
+            time = min(time, chrono::duration<double>(chrono::steady_clock::now()-start).count());
+        }
+        if (time < bestTime) { bestTime = time; best = kernel; }
+    }
+    return best;
+}
+
+// State hashing for oscillation checks: a state's hash is the sum of cellHash over its written cells, so it can be
+// updated from the cells that changed alone.
+static inline uint64_t hashMix(uint64_t x) noexcept {
+    x ^= x >> 31; x *= 0xbf58476d1ce4e5b9ull; x ^= x >> 29; x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 32);
+}
+static inline uint64_t cellHash(STORAGE c, STORAGE value) noexcept { return hashMix(value+c*0x9e3779b97f4a7c15ull); }
+
+// Sense-reversing barrier: the last thread to arrive flips the shared sense, the others spin until they see it.
+struct Barrier {
+    alignas(64) atomic<int> count;
+    alignas(64) atomic<bool> sense{false};
+    int total;
+    explicit Barrier(int n):count(n), total(n) {}
+    // With `abort`, waiters also give up once it is set, e.g. when a peer process died before arriving.
+    void wait(bool& local, const atomic<bool>* abort = nullptr) noexcept {
+        local = !local;
+        if (count.fetch_sub(1, memory_order_acq_rel) == 1) {
+            count.store(total, memory_order_relaxed);
+            sense.store(local, memory_order_release);
+            return;
+        }
+        for (int spins = 0; sense.load(memory_order_acquire) != local; spins++) {
+            if (abort && abort->load(memory_order_relaxed)) return;
+            #if defined(__x86_64__)
+            _mm_pause();
+            #endif
+            if (spins > 1024) this_thread::yield();
+        }
+    }
+};
+
+// Long-lived pinned workers with owner-computes partitions of the instruction stream. Partition bounds sit on
+// cache-line multiples of the tape and an operation belongs to the partition holding its result cell (the one
+// before its opcode), so neighbouring owners do not write the same lines. Each owner builds its own instruction
+// list so that it is first touched on its node, and idle workers steal chunks from others. Only the threads the
+// pool starts are pinned; the calling thread runs partition 0 with its affinity untouched.
+struct WorkerPool {
+    struct alignas(64) Partition {
+        STORAGE begin = 0, end = 0;
+        vector<STORAGE> ops;
+        atomic<size_t> next{0};
+        bool modified = false;
+    };
+    static const size_t chunk = 256;
+    int threads;
+    size_t serialBelow;
+    size_t total = 0;
+    STORAGE* T;
+    unique_ptr<Partition[]> parts;
+    Barrier barrier;
+    bool stop = false;
+    bool sense = false;
+    vector<thread> workers;
+
+    WorkerPool(Program& prog, int threads_, size_t serialBelow_)
+        : threads(max(threads_, 1)), serialBelow(serialBelow_), T(prog.tape.data), parts(new Partition[max(threads_, 1)]), barrier(max(threads_, 1)) {
+        const STORAGE line = 64/sizeof(STORAGE);
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1) total++;
+        size_t seen = 0;
+        int p = 0;
+        for (STORAGE i = 0; i < prog.tape_pos && p < threads-1; i++) {
+            if (prog.iscall[i] == 1) seen++;
+            if (seen >= total*(p+1)/threads && i % line == line-1) parts[++p].begin = i+1;
+        }
+        for (int k = 0; k < threads; k++) parts[k].end = k+1 < threads && k+1 <= p ? parts[k+1].begin : (k <= p ? prog.tape_pos : 0);
+        for (int k = p+1; k < threads; k++) parts[k].begin = parts[k].end = 0;
+        TAG* C = prog.iscall.data;
+        STORAGE tapeEnd = prog.tape_pos;
+        auto own = [this, C, tapeEnd](int id) {
+            Partition& part = parts[id];
+            for (STORAGE i = part.begin+1; i <= part.end && i < tapeEnd; i++) if (C[i] == 1) part.ops.push_back(i);
+        };
+        for (int id = 1; id < threads; id++) workers.emplace_back([this, own, id] {
+            bool local = false;
+            pin(id);
+            own(id);
+            barrier.wait(local);
+            while (true) {
+                barrier.wait(local);
+                if (stop) break;
+                work(id);
+                barrier.wait(local);
+            }
+        });
+        own(0);
+        barrier.wait(sense);
+    }
+    ~WorkerPool() {
+        stop = true;
+        if (!workers.empty()) barrier.wait(sense);
+        for (auto& w : workers) w.join();
+    }
+    void pin(int id) {
+        #if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(id % max(1u, thread::hardware_concurrency()), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        #endif
+    }
+    // Runs the own partition first, then steals chunks from the others in ring order.
+    void work(int id) noexcept {
+        bool modified = false;
+        for (int k = 0; k < threads; k++) {
+            Partition& part = parts[(id+k)%threads];
+            for (size_t c; (c = part.next.fetch_add(chunk, memory_order_relaxed)) < part.ops.size();) {
+                size_t n = min(part.ops.size(), c+chunk);
+                for (size_t j = c; j < n; j++) if (exec(T, part.ops[j]) >= 0) modified = true;
+            }
+        }
+        parts[id].modified = modified;
+    }
+    bool step() noexcept {
+        for (int k = 0; k < threads; k++) { parts[k].next.store(0, memory_order_relaxed); parts[k].modified = false; }
+        if (total < serialBelow || workers.empty()) work(0);
+        else {
+            barrier.wait(sense);
+            work(0);
+            barrier.wait(sense);
+        }
+        bool modified = false;
+        for (int k = 0; k < threads; k++) modified = modified || parts[k].modified;
+        return modified;
+    }
+};
+
+// Multi-process sharded execution. The instructions are split into contiguous slices, one per forked worker
+// process. Each worker runs its slice in tape order on a private copy of the tape, and mirrors the cells it writes
+// into the shared tape for the output thread and the final report. Cells written in one slice and read (or also
+// written) in another are boundary cells. After each loop a worker pushes the ones that changed into a
+// single-producer ring per peer, publishes its modified flag and meets the others at a barrier in a shared control
+// segment. It then applies what its peers sent, and every worker stops on the same loop once no flag is set.
+// Peers therefore see each other's values one loop late, as in jacobi mode, and a multi-writer cell keeps the
+// value from whichever worker wrote last. A worker that dies sets no flags; the parent notices, raises abort, and
+// the survivors leave the barrier. For the oscillation check every worker also publishes the hash of the cells it
+// writes; all of them run the same Brent check on the sum, and on a match compare their own cells with the saved
+// state in one extra barrier round, so they agree on stopping. Cells rewritten since the save are the culprits.
+struct Shards {
+    typedef pair<STORAGE,STORAGE> Entry; // cell, value
+    // Holds up to two loops of entries: the producer may push loop L+1 while the consumer still drains loop L.
+    struct Ring {
+        alignas(64) atomic<size_t> head{0};
+        alignas(64) atomic<size_t> tail{0};
+        size_t capacity;
+        size_t pushed[2] = {0, 0}; // entries sent in the loops of each parity
+        explicit Ring(size_t capacity_) : capacity(capacity_) {}
+        Entry* slots() { return (Entry*)(this+1); }
+        void push(Entry e) noexcept {
+            size_t t = tail.load(memory_order_relaxed);
+            slots()[t % capacity] = e;
+            tail.store(t+1, memory_order_release);
+        }
+        Entry pop() noexcept {
+            size_t h = head.load(memory_order_relaxed);
+            while (tail.load(memory_order_acquire) == h) this_thread::yield();
+            Entry e = slots()[h % capacity];
+            head.store(h+1, memory_order_release);
+            return e;
+        }
+    };
+    struct Control {
+        Barrier barrier;
+        atomic<bool> abort{false};
+        atomic<STORAGE> loops{0};
+        atomic<STORAGE> period{0};
+        explicit Control(int n) : barrier(n) {}
+    };
+    static constexpr size_t none = SIZE_MAX;
+    int procs;
+    STORAGE* T;
+    STORAGE cells;
+    vector<vector<STORAGE>> ops, owned;     // per worker: instructions, cells written
+    vector<vector<vector<STORAGE>>> sends;  // [from][to] boundary cells
+    vector<vector<size_t>> ringAt;          // [from][to] offset of the ring in the segment, or none
+    char* segment = nullptr;
+    size_t segmentBytes = 0;
+    Control* control = nullptr;
+    uint8_t* modified = nullptr;            // [parity][worker]
+    uint64_t* hashes = nullptr;             // [parity][worker]
+    uint8_t* same = nullptr;                // [worker]
+    uint8_t* culprit = nullptr;             // [cell]
+    bool checkOscillation;
+    vector<pid_t> pids;
+
+    Shards(Program& prog, int procs_, STORAGE maxloops, bool checkOscillation_)
+        : procs(max(procs_, 1)), T(prog.tape.data), cells(prog.tape_pos), checkOscillation(checkOscillation_) {
+        for (STORAGE i = 0; i < cells; i++) if (prog.iscall[i] >= 3) throw runtime_error("--mode=shard does not support arrays");
+        vector<STORAGE> all;
+        for (STORAGE i = 0; i < cells; i++) { STORAGE z, r; if (prog.iscall[i] == 1 && evaluate(T, i, z, r)) all.push_back(i); }
+        ops.resize(procs); owned.resize(procs);
+        vector<vector<int>> writers(cells), readers(cells);
+        auto add = [](vector<int>& v, int p) { if (v.empty() || v.back() != p) v.push_back(p); };
+        for (int p = 0; p < procs; p++)
+            for (size_t k = all.size()*p/procs; k < all.size()*(p+1)/procs; k++) {
+                STORAGE i = all[k], z, r;
+                ops[p].push_back(i);
+                evaluate(T, i, z, r);
+                if (writers[z].empty() || writers[z].back() != p) owned[p].push_back(z);
+                add(writers[z], p);
+                auto [a, b] = sources(T, i);
+                add(readers[a], p);
+                if (b >= 0) add(readers[b], p);
+            }
+        sends.assign(procs, vector<vector<STORAGE>>(procs));
+        for (STORAGE c = 0; c < cells; c++) for (int p : writers[c]) {
+            vector<int> to(readers[c]);
+            to.insert(to.end(), writers[c].begin(), writers[c].end());
+            sort(to.begin(), to.end());
+            to.erase(unique(to.begin(), to.end()), to.end());
+            for (int q : to) if (q != p) sends[p][q].push_back(c);
+        }
+
+        auto align = [](size_t n) { return (n+63)/64*64; };
+        segmentBytes = align(sizeof(Control)) + align(2*procs) + align(2*procs*sizeof(uint64_t)) + align(procs) + align(cells);
+        ringAt.assign(procs, vector<size_t>(procs, none));
+        for (int p = 0; p < procs; p++) for (int q = 0; q < procs; q++) if (!sends[p][q].empty()) {
+            ringAt[p][q] = segmentBytes;
+            segmentBytes += align(sizeof(Ring) + (2*sends[p][q].size()+1)*sizeof(Entry));
+        }
+        void* mem = mmap(nullptr, segmentBytes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) throw runtime_error("Cannot map the shard control segment");
+        segment = (char*)mem;
+        control = new (segment) Control(procs);
+        modified = (uint8_t*)segment + align(sizeof(Control));
+        hashes = (uint64_t*)(modified + align(2*procs));
+        same = (uint8_t*)hashes + align(2*procs*sizeof(uint64_t));
+        culprit = same + align(procs);
+        for (int p = 0; p < procs; p++) for (int q = 0; q < procs; q++)
+            if (ringAt[p][q] != none) new (segment+ringAt[p][q]) Ring(2*sends[p][q].size()+1);
+
+        fflush(nullptr);
+        for (int p = 0; p < procs; p++) {
+            pid_t pid = fork();
+            if (pid < 0) { control->abort = true; throw runtime_error("Cannot fork shard worker"); }
+            if (pid == 0) { work(p, maxloops); _exit(0); }
+            pids.push_back(pid);
+        }
+    }
+    ~Shards() {
+        if (!pids.empty()) { control->abort = true; for (pid_t pid : pids) waitpid(pid, nullptr, 0); }
+        if (segment) munmap(segment, segmentBytes);
+    }
+    Ring& ring(int from, int to) { return *(Ring*)(segment+ringAt[from][to]); }
+
+    void work(int p, STORAGE maxloops) noexcept {
+        #if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(p % max(1u, thread::hardware_concurrency()), &set);
+        sched_setaffinity(0, sizeof(set), &set);
+        #endif
+        vector<STORAGE> local(T, T+cells); // first touched on this worker's node
+        vector<vector<STORAGE>> last(procs);
+        for (int q = 0; q < procs; q++) for (STORAGE c : sends[p][q]) last[q].push_back(local[c]);
+        uint64_t hash = 0, savedHash = 0;
+        STORAGE savedLoop = 0;
+        vector<STORAGE> hashed(owned[p].size()), saved;
+        vector<char> touched(checkOscillation ? cells : 0, 0);
+        for (size_t k = 0; k < owned[p].size(); k++) { hashed[k] = local[owned[p][k]]; hash += cellHash(owned[p][k], hashed[k]); }
+        bool sense = false;
+        control->barrier.wait(sense, &control->abort); // every copy is taken before anyone writes the shared tape
+        for (STORAGE loop = 1; loop <= maxloops && !control->abort; loop++) {
+            bool changed = false;
+            for (STORAGE i : ops[p]) {
+                STORAGE z = exec(local.data(), i);
+                if (z < 0) continue;
+                changed = true;
+                if (checkOscillation) touched[z] = 1;
+            }
+            for (size_t k = 0; k < owned[p].size(); k++) {
+                STORAGE c = owned[p][k];
+                if (local[c] == hashed[k]) continue;
+                __atomic_store_n(&T[c], local[c], __ATOMIC_RELAXED);
+                hash += cellHash(c, local[c])-cellHash(c, hashed[k]);
+                hashed[k] = local[c];
+            }
+            for (int q = 0; q < procs; q++) if (ringAt[p][q] != none) {
+                Ring& r = ring(p, q);
+                size_t count = 0;
+                for (size_t k = 0; k < sends[p][q].size(); k++) {
+                    STORAGE c = sends[p][q][k];
+                    if (local[c] == last[q][k]) continue;
+                    last[q][k] = local[c];
+                    r.push({c, local[c]});
+                    count++;
+                }
+                r.pushed[loop&1] = count;
+            }
+            modified[(loop&1)*procs+p] = changed;
+            hashes[(loop&1)*procs+p] = hash;
+            control->barrier.wait(sense, &control->abort);
+            if (control->abort) break;
+            for (int q = 0; q < procs; q++) if (ringAt[q][p] != none) {
+                Ring& r = ring(q, p);
+                for (size_t k = r.pushed[loop&1]; k > 0; k--) { Entry e = r.pop(); local[e.first] = e.second; }
+            }
+            bool any = false;
+            for (int q = 0; q < procs; q++) any = any || modified[(loop&1)*procs+q];
+            if (p == 0) control->loops.store(loop, memory_order_relaxed);
+            if (!any) break;
+            if (!checkOscillation || loop < 16) continue;
+            uint64_t global = 0;
+            for (int q = 0; q < procs; q++) global += hashes[(loop&1)*procs+q];
+            if (savedLoop && global == savedHash) {
+                same[p] = equal(hashed.begin(), hashed.end(), saved.begin());
+                control->barrier.wait(sense, &control->abort);
+                if (control->abort) break;
+                bool repeated = true;
+                for (int q = 0; q < procs; q++) repeated = repeated && same[q];
+                if (repeated) {
+                    for (STORAGE c : owned[p]) if (touched[c]) culprit[c] = 1;
+                    if (p == 0) control->period.store(loop-savedLoop, memory_order_relaxed);
+                    break;
+                }
+            }
+            if (loop >= 2*savedLoop) {
+                savedHash = global;
+                savedLoop = loop;
+                saved = hashed;
+                fill(touched.begin(), touched.end(), 0);
+            }
+        }
+    }
+
+    // Waits for every worker and returns the loops they ran; a crashed worker aborts the others.
+    STORAGE wait() {
+        string crashed;
+        for (size_t n = 0; n < pids.size(); n++) {
+            int status;
+            pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0) break;
+            bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (!clean && !control->abort.exchange(true)) {
+                size_t p = find(pids.begin(), pids.end(), pid)-pids.begin();
+                crashed = "Shard worker "+to_string(p)+(WIFSIGNALED(status) ? " killed by signal "+to_string(WTERMSIG(status)) : " failed");
+            }
+        }
+        pids.clear();
+        if (!crashed.empty()) throw runtime_error(crashed);
+        return control->loops.load();
+    }
+};
+
+// Stream output, off the compute path. A background thread wakes every `refresh` ms, compares only the cells that
+// feed streams with the values it last saw, and re-renders just the streams that changed. `out` redraws the
+// terminal (or, when the console is not a terminal, prints once at the end without escape codes); every other
+// stream appends one line per change to a buffered file sink, `name.out` unless bound elsewhere with
+// --stream=name:path, where a path starting with | is a shell command fed through a pipe.
+struct Output {
+    // Strings point into the program's pool; numbers keep the text of the last value seen, arrays their first values.
+    struct Item { STORAGE loc; bool constant; string_view text; char number[32]; string values; };
+    struct Stream { string name; vector<Item> items; vector<STORAGE> seen; bool shown = false; FILE* sink = nullptr; bool pipe = false; };
+    vector<Stream> streams;
+    const Program& prog;
+    const STORAGE* T;
+    ostream& console;
+    bool tty;
+    int refresh;
+    atomic<STORAGE> loops{0};
+    bool finished = false;
+    mutex lock;
+    condition_variable wake;
+    thread worker;
+
+    Output(const Program& prog, ostream& console_, bool tty_, int refresh_, const map<string,string>& bindings)
+        : prog(prog), T(prog.tape.data), console(console_), tty(tty_), refresh(refresh_) {
+        streams.resize(prog.nextStreamId);
+        for (auto& [name, id] : prog.streamIds) streams[id].name = name;
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1 && prog.tape[i] == 0x04) {
+            STORAGE loc = prog.tape[i+1];
+            Stream& stream = streams[prog.tape[i+2]-16];
+            Item item{loc, prog.iscall[loc] == 2, {}, {}, {}};
+            if (item.constant) item.text = prog.str(prog.tape[loc]);
+            stream.items.push_back(item);
+            stream.seen.push_back(~prog.tape[loc]);
+        }
+        for (size_t id = 1; id < streams.size(); id++) if (!streams[id].items.empty()) {
+            Stream& stream = streams[id];
+            auto bound = bindings.find(stream.name);
+            string path = bound == bindings.end() ? stream.name+".out" : bound->second;
+            stream.pipe = path[0] == '|';
+            stream.sink = stream.pipe ? popen(path.c_str()+1, "w") : fopen(path.c_str(), "w");
+            if (!stream.sink) throw runtime_error("Cannot open stream "+stream.name+": "+path);
+        }
+        if (tty) console << "\033[2J\n" << flush; // clear screen first
+        if (refresh > 0) worker = thread([this] {
+            unique_lock<mutex> guard(lock);
+            while (!wake.wait_for(guard, chrono::milliseconds(refresh), [this]{ return finished; })) poll(tty);
+        });
+    }
+    ~Output() {
+        if (worker.joinable()) { { lock_guard<mutex> guard(lock); finished = true; } wake.notify_all(); worker.join(); }
+        for (auto& stream : streams) if (stream.sink) { if (stream.pipe) pclose(stream.sink); else fclose(stream.sink); }
+    }
+
+    // Reformats the numbers whose source cells changed since the last call; true if the stream must be rewritten.
+    bool update(Stream& stream) {
+        bool dirty = !stream.shown;
+        stream.shown = true;
+        for (size_t k = 0; k < stream.items.size(); k++) if (!stream.items[k].constant) {
+            Item& item = stream.items[k];
+            bool array = prog.iscall[item.loc] == 3;
+            STORAGE value = array ? __atomic_load_n(&prog.arrays[T[item.loc]].version, __ATOMIC_RELAXED) : __atomic_load_n(&T[item.loc], __ATOMIC_RELAXED);
+            if (value == stream.seen[k] && !item.text.empty()) continue;
+            stream.seen[k] = value;
+            dirty = true;
+            if (!array) { item.text = string_view(item.number, snprintf(item.number, sizeof(item.number), "%f", fromi(value).d)); continue; }
+            const Program::Array& a = prog.arrays[T[item.loc]];
+            const double* values = prog.array(T[item.loc]);
+            item.values = "[";
+            for (STORAGE e = 0; e < a.length && e < 8; e++) item.values += (e ? ", " : "")+to_string(values[e]);
+            if (a.length > 8) item.values += ", ... ("+to_string(a.length)+" values)";
+            item.values += "]";
+            item.text = item.values;
+        }
+        return dirty;
+    }
+    void write(Stream& stream, FILE* sink) { for (auto& item : stream.items) fwrite(item.text.data(), 1, item.text.size(), sink); }
+    void write(Stream& stream, ostream& sink) { for (auto& item : stream.items) sink << item.text; }
+    void poll(bool redraw) {
+        for (size_t id = 1; id < streams.size(); id++) if (streams[id].sink && update(streams[id])) {
+            write(streams[id], streams[id].sink);
+            fputc('\n', streams[id].sink);
+        }
+        if (redraw && !streams.empty() && update(streams[0])) {
+            console << "\033[2J\033[H";
+            write(streams[0], console);
+            console << "\nRunning (terminate with ctrl+c)\n" << flush;
+        }
+    }
+    // Stops the refresh thread and writes the final state of every stream followed by the report.
+    void finish(const string& report) {
+        { lock_guard<mutex> guard(lock); finished = true; }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+        poll(false);
+        if (!streams.empty()) update(streams[0]);
+        for (auto& stream : streams) if (stream.sink) fflush(stream.sink);
+        if (tty) console << "\033[2J\033[H";
+        if (!streams.empty()) write(streams[0], console);
+        console << "\n" << report << flush;
+    }
+};
+
+// C++ string literal for arbitrary bytes.
+static string quoted(string_view text) {
+    string out = "\"";
+    for (unsigned char ch : text) {
+        if (ch == '\n') out += "\\n";
+        else if (ch == '\t') out += "\\t";
+        else if (ch == '"' || ch == '\\') { out += '\\'; out += ch; }
+        else if (ch < 32 || ch >= 127) { char buf[8]; snprintf(buf, sizeof(buf), "\\%03o", ch); out += buf; }
+        else out += ch;
+    }
+    return out+"\"";
+}
+
+// --profile: per-opcode counts and time, cells changed per loop, the most rewritten cells and per-thread busy time.
+// Instruction-level counters exist only in the Profile instantiations of the sweep and seq steps; the loop-level
+// figures diff the written cells after every loop and work in every mode.
+static inline uint64_t ticks() noexcept {
+    #if defined(__x86_64__)
+    return __rdtsc();
+    #else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    #endif
+}
+static inline int threadNum() noexcept {
+    #ifdef _OPENMP
+    return omp_get_thread_num();
+    #else
+    return 0;
+    #endif
+}
+static inline int maxThreads() noexcept {
+    #ifdef _OPENMP
+    return omp_get_max_threads();
+    #else
+    return 1;
+    #endif
+}
+
+struct Profile {
+    array<uint64_t,16> count{}, ticks{};  // by opcode
+    vector<STORAGE> changedPerLoop;
+    vector<uint64_t> changes;             // per written cell, loops in which it changed
+    vector<STORAGE> previous;
+    vector<double> busy, idle;            // ns per thread inside the instruction loop
+    uint64_t startTicks = 0, endTicks = 0;
+    double ms = 0;
+
+    static const char* opName(int op) {
+        switch (op) { case 0x02: return "*"; case 0x03: return "+"; case 0x04: return "|"; case 0x05: return "=";
+                      case 0x07: return "^"; case 0x08: return "<"; default: return "?"; }
+    }
+    double nsPerTick() const { return endTicks > startTicks ? ms*1e6/(endTicks-startTicks) : 0; }
+    static const Label* labelFor(const Program& prog, STORAGE cell) {
+        for (size_t k = prog.labels.size(); k-- > 0;) if (prog.labels[k].tape_index == cell && prog.labels[k].name != "__") return &prog.labels[k];
+        return nullptr;
+    }
+    vector<size_t> hottest(size_t top) const {
+        vector<size_t> order;
+        for (size_t k = 0; k < changes.size(); k++) if (changes[k]) order.push_back(k);
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return changes[a] > changes[b] || (changes[a] == changes[b] && a < b); });
+        if (order.size() > top) order.resize(top);
+        return order;
+    }
+
+    string text(const Program& prog, const vector<STORAGE>& written, const string& mode, STORAGE loops) const {
+        std::ostringstream out;
+        char line[160];
+        snprintf(line, sizeof(line), "Profile (%s, %lld loops, %.1fms)\n", mode.c_str(), (long long)loops, ms); out << line;
+        bool any = false;
+        for (int op = 0; op < 16; op++) if (count[op]) {
+            if (!any) { out << "  op        count          ms     ns/op\n"; any = true; }
+            double t = ticks[op]*nsPerTick();
+            snprintf(line, sizeof(line), "  %-2s %12llu %11.3f %9.2f\n", opName(op), (unsigned long long)count[op], t/1e6, t/count[op]); out << line;
+        }
+        if (!any) out << "  (per-opcode counts are collected in sweep and seq modes)\n";
+        out << "  changed per loop:";
+        size_t n = changedPerLoop.size(), shown = min<size_t>(n, 24);
+        for (size_t k = 0; k < shown; k++) out << " " << changedPerLoop[k];
+        if (n > shown) out << " ... " << changedPerLoop[n-1];
+        auto hot = hottest(10);
+        out << "\n  hottest cells:" << (hot.empty() ? " none\n" : "\n");
+        for (size_t k : hot) {
+            const Label* label = labelFor(prog, written[k]);
+            snprintf(line, sizeof(line), "  %10llu  %s (line %lld)\n", (unsigned long long)changes[k],
+                     label ? label->name.c_str() : ("@"+to_string(written[k])).c_str(), label ? (long long)label->line : 0LL); out << line;
+        }
+        for (size_t t = 0; t < busy.size(); t++) {
+            snprintf(line, sizeof(line), "  thread %zu: %.3fms busy, %.3fms idle\n", t, busy[t]/1e6, idle[t]/1e6); out << line;
+        }
+        return out.str();
+    }
+
+    string json(const Program& prog, const vector<STORAGE>& written, const string& mode, STORAGE loops) const {
+        std::ostringstream out;
+        out << "{\"mode\": \"" << mode << "\", \"loops\": " << loops << ", \"ms\": " << ms << ",\n \"opcodes\": [";
+        bool first = true;
+        for (int op = 0; op < 16; op++) if (count[op]) {
+            out << (first ? "" : ", ") << "{\"op\": \"" << opName(op) << "\", \"count\": " << count[op] << ", \"ns\": " << ticks[op]*nsPerTick() << "}";
+            first = false;
+        }
+        out << "],\n \"changed_per_loop\": [";
+        for (size_t k = 0; k < changedPerLoop.size(); k++) out << (k ? ", " : "") << changedPerLoop[k];
+        out << "],\n \"hot_cells\": [";
+        first = true;
+        for (size_t k : hottest(100)) {
+            const Label* label = labelFor(prog, written[k]);
+            out << (first ? "" : ", ") << "{\"cell\": " << written[k] << ", \"label\": " << quoted(label ? label->name : "@"+to_string(written[k]))
+                << ", \"line\": " << (label ? label->line : 0) << ", \"changes\": " << changes[k] << "}";
+            first = false;
+        }
+        out << "],\n \"threads\": [";
+        for (size_t t = 0; t < busy.size(); t++) out << (t ? ", " : "") << "{\"busy_ns\": " << busy[t] << ", \"idle_ns\": " << idle[t] << "}";
+        out << "]}\n";
+        return out.str();
+    }
 };
 
 struct VM {
     Program prog;
+    string mode = "sweep";
+    // worklist mode: CSR index from each cell to the instructions reading it, and the instructions to run next
+    vector<STORAGE> userStart, users, pending;
+    vector<TAG> queued;
+    // simd mode: opcode batches and the kernel that runs them
+    string simd = "auto";
+    Lowered lowered;
+    Kernel kernel = kernel_scalar;
+    // jacobi mode: the last writer of each destination in tape order, and the back buffer of their results
+    vector<STORAGE> writers, writerDst, back;
+    // levels mode: strongly connected components of the writers in topological order, grouped into levels
+    vector<STORAGE> compStart, compMembers, compIterations;
+    vector<TAG> compCyclic;
+    vector<vector<STORAGE>> levels;
+    bool cycleExceeded = false;
+    // pool mode: persistent workers, their count and the instruction count below which a loop runs serially
+    unique_ptr<WorkerPool> pool;
+    // shard mode: worker processes over a shared tape
+    unique_ptr<Shards> shards;
+    int processes = max(1u, thread::hardware_concurrency());
+    int threads = max(1u, thread::hardware_concurrency());
+    size_t serialBelow = 4096;
+    STORAGE maxloops = 100000;
+    STORAGE loops = 0;
+    bool quiet = false; // skip console output, e.g. when measuring
+    ostream* console = &cout;
+    int tty = -1; // use terminal escape codes: 1 always, 0 never, -1 when the console is a terminal
+    int refresh = 100; // ms between stream refreshes while running, 0 for output at the end only
+    map<string,string> sinks; // stream name -> file path, or |command
+    // array instructions (tag 4) in tape order, with the operand versions each one last ran on
+    vector<STORAGE> arrayOps;
+    vector<array<uint64_t,3>> arraySeen;
+    // oscillation check (Brent): the hash of the written cells is compared with the state saved at the last
+    // power-of-two loop; an exact match means the run repeats with `period` and will never settle
+    bool checkOscillation = true;
+    vector<STORAGE> written, savedState, culprits;
+    // the hash is a sum over the written cells, kept up to date from the cells that changed: the worklist reports
+    // them in `dirty`, the other modes already touch every instruction per loop and rescan `written`
+    uint64_t hash = 0;
+    vector<STORAGE> hashed, dirty; // hashed: value each written cell has in `hash`, by cell
+    uint64_t savedHash = 0;
+    STORAGE savedLoop = 0, period = 0;
+    // --profile
+    bool profile = false;
+    string profileJson; // path for the JSON report, empty for none
+    Profile prof;
     explicit VM(Program p):prog(std::move(p)) {}
 
     // bool step_once() noexcept {
     //     bool modified = false;
-    //     STORAGE* T = prog.tape;
-    //     STORAGE* C = prog.iscall;
+    //     STORAGE* T = prog.tape.data;
+    //     TAG* C = prog.iscall.data;
     //     for (STORAGE i = 0; i < prog.tape_pos; i++) {
     //         if (C[i] != 1) continue;
     //         STORAGE op = T[i];
@@ -55,58 +1003,667 @@ struct VM {
     //     return modified;
     // }
 
+    template <bool Profile>
     bool step_once() noexcept {
         bool modified = false;
-        STORAGE* T = prog.tape;
-        STORAGE* C = prog.iscall;
+        STORAGE* T = prog.tape.data;
+        TAG* C = prog.iscall.data;
+
+        if constexpr (!Profile) {
+            #pragma omp parallel for reduction(||:modified)
+            for (STORAGE i = 0; i < prog.tape_pos; i++) {
+                if (C[i] != 1) continue;
+                if (exec(T, i) >= 0) modified = true;
+            }
+        } else {
+            vector<double> busy(maxThreads(), 0);
+            auto region = chrono::steady_clock::now();
+            #pragma omp parallel reduction(||:modified)
+            {
+                auto begin = chrono::steady_clock::now();
+                array<uint64_t,16> count{}, spent{};
+                #pragma omp for nowait
+                for (STORAGE i = 0; i < prog.tape_pos; i++) {
+                    if (C[i] != 1) continue;
+                    uint64_t t0 = ticks();
+                    if (exec(T, i) >= 0) modified = true;
+                    spent[T[i] & 15] += ticks()-t0;
+                    count[T[i] & 15]++;
+                }
+                busy[threadNum()] = chrono::duration<double, nano>(chrono::steady_clock::now()-begin).count();
+                #pragma omp critical
+                for (int op = 0; op < 16; op++) { prof.count[op] += count[op]; prof.ticks[op] += spent[op]; }
+            }
+            double total = chrono::duration<double, nano>(chrono::steady_clock::now()-region).count();
+            prof.busy.resize(busy.size()); prof.idle.resize(busy.size());
+            for (size_t t = 0; t < busy.size(); t++) { prof.busy[t] += busy[t]; prof.idle[t] += max(0.0, total-busy[t]); }
+        }
+
+        return modified;
+    }
+
+    // Users of a cell are the instructions that read it, plus all of its writers when it has more than one: a write
+    // must re-queue the other writers, or the cell keeps whichever value happened to be written last.
+    void buildUsers() {
+        STORAGE* T = prog.tape.data;
+        TAG* C = prog.iscall.data;
+        userStart.assign(prog.tape_pos+1, 0);
+        pending.clear();
+        vector<STORAGE> writes(prog.tape_pos, 0);
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (C[i] == 1 && sources(T, i).first >= 0) {
+            writes[T[i] == 0x05 ? T[i+1] : i-1]++;
+            pending.push_back(i);
+        }
+        auto each = [&](STORAGE i, auto&& f) {
+            auto [a, b] = sources(T, i);
+            STORAGE z = T[i] == 0x05 ? T[i+1] : i-1;
+            f(a);
+            if (b >= 0 && b != a) f(b);
+            if (writes[z] > 1 && z != a && z != b) f(z);
+        };
+        for (STORAGE i : pending) each(i, [&](STORAGE c) { userStart[c+1]++; });
+        for (STORAGE k = 0; k < prog.tape_pos; k++) userStart[k+1] += userStart[k];
+        users.resize(userStart[prog.tape_pos]);
+        vector<STORAGE> fill(userStart.begin(), userStart.end()-1);
+        for (STORAGE i : pending) each(i, [&](STORAGE c) { users[fill[c]++] = i; });
+        queued.assign(prog.tape_pos, 0);
+        for (STORAGE i : pending) queued[i] = 1;
+    }
+
+    // Runs only the instructions whose inputs were written by the previous step; the first step runs all of them.
+    bool step_worklist() {
+        STORAGE* T = prog.tape.data;
+        vector<STORAGE> current;
+        current.swap(pending);
+        for (STORAGE i : current) queued[i] = 0;
+        vector<STORAGE> changed;
+        #pragma omp parallel
+        {
+            vector<STORAGE> local;
+            #pragma omp for nowait
+            for (size_t k = 0; k < current.size(); k++) {
+                STORAGE z = exec(T, current[k]);
+                if (z >= 0) local.push_back(z);
+            }
+            #pragma omp critical
+            changed.insert(changed.end(), local.begin(), local.end());
+        }
+        if (checkOscillation) dirty.insert(dirty.end(), changed.begin(), changed.end());
+        for (STORAGE z : changed)
+            for (STORAGE u = userStart[z]; u < userStart[z+1]; u++)
+                if (!queued[users[u]]) { queued[users[u]] = 1; pending.push_back(users[u]); }
+        return !changed.empty();
+    }
+
+    // Runs each opcode batch in cache-sized chunks, one chunk per task.
+    bool step_simd() noexcept {
+        const size_t chunk = 4096;
+        bool modified = false;
+        STORAGE* T = prog.tape.data;
+        for (auto& batch : lowered.batches) {
+            STORAGE chunks = (batch.dst.size()+chunk-1)/chunk;
+            #pragma omp parallel for reduction(||:modified) if(chunks>1)
+            for (STORAGE c = 0; c < chunks; c++) {
+                size_t k = c*chunk, n = min(chunk, batch.dst.size()-k);
+                if (kernel(batch.op, T, batch.dst.data()+k, batch.a.data()+k, batch.b.data()+k, n)) modified = true;
+            }
+        }
+        return modified;
+    }
+
+    // Ordered sweep in tape order: later instructions see values written earlier in the same loop.
+    template <bool Profile>
+    bool step_seq() noexcept {
+        bool modified = false;
+        STORAGE* T = prog.tape.data;
+        TAG* C = prog.iscall.data;
+        if constexpr (!Profile) {
+            for (STORAGE i = 0; i < prog.tape_pos; i++) if (C[i] == 1 && exec(T, i) >= 0) modified = true;
+        } else {
+            auto begin = chrono::steady_clock::now();
+            for (STORAGE i = 0; i < prog.tape_pos; i++) if (C[i] == 1) {
+                uint64_t t0 = ticks();
+                if (exec(T, i) >= 0) modified = true;
+                prof.ticks[T[i] & 15] += ticks()-t0;
+                prof.count[T[i] & 15]++;
+            }
+            prof.busy.resize(1); prof.idle.resize(1);
+            prof.busy[0] += chrono::duration<double, nano>(chrono::steady_clock::now()-begin).count();
+        }
+        return modified;
+    }
+
+    void profileLoop() {
+        const STORAGE* T = prog.tape.data;
+        STORAGE changed = 0;
+        for (size_t k = 0; k < written.size(); k++) if (T[written[k]] != prof.previous[k]) {
+            prof.previous[k] = T[written[k]];
+            prof.changes[k]++;
+            changed++;
+        }
+        prof.changedPerLoop.push_back(changed);
+    }
+
+    // When several instructions write the same cell, only the last one in tape order is kept, as in seq mode.
+    void buildWriters() {
+        STORAGE* T = prog.tape.data;
+        vector<STORAGE> last(prog.tape_pos, -1);
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1) {
+            STORAGE zpos, r;
+            if (evaluate(T, i, zpos, r)) last[zpos] = i;
+        }
+        writers.clear(); writerDst.clear();
+        for (STORAGE z = 0; z < prog.tape_pos; z++) if (last[z] >= 0) { writers.push_back(last[z]); writerDst.push_back(z); }
+        back.assign(writers.size(), 0);
+    }
 
+    // Reads only the front buffer (the tape) and writes the back buffer, then commits; no thread sees a partial loop.
+    bool step_jacobi() noexcept {
+        bool modified = false;
+        STORAGE* T = prog.tape.data;
+        STORAGE n = writers.size();
         #pragma omp parallel for reduction(||:modified)
-        for (STORAGE i = 0; i < prog.tape_pos; i++) {
-            if (C[i] != 1) continue;
-            STORAGE op = T[i];
-            if (op == 0x02) {STORAGE zpos=i-1;STORAGE a=T[T[i+1]];STORAGE b=T[T[i+2]];STORAGE r=fromd(fromi(a).d*fromi(b).d).i;if(T[zpos]!=r)modified=true;T[zpos]=r;}
-            else if (op == 0x03) {STORAGE zpos=i-1;STORAGE a=T[T[i+1]];STORAGE b=T[T[i+2]];STORAGE r=fromd(fromi(a).d+fromi(b).d).i;if(T[zpos]!=r)modified=true;T[zpos]=r;}
-            else if (op == 0x07) {STORAGE zpos=i-1;STORAGE a=T[T[i+1]];STORAGE b=T[T[i+2]];STORAGE r=fromd(pow(fromi(a).d,fromi(b).d)).i;if(T[zpos]!=r)modified=true;T[zpos]=r;}
-            else if (op == 0x08) {STORAGE zpos=i-1;STORAGE a=T[T[i+1]];STORAGE b=T[T[i+2]];STORAGE r=fromd((fromi(a).d<fromi(b).d)?1.0:-1.0).i;if(T[zpos]!=r)modified=true;T[zpos]=r;}
-            else if (op == 0x05) {STORAGE lhs=T[i+1];STORAGE rhs=T[i+2];if(T[lhs]!=T[rhs])modified=true;T[lhs]=T[rhs];}
+        for (STORAGE k = 0; k < n; k++) {
+            STORAGE zpos;
+            evaluate(T, writers[k], zpos, back[k]);
+            if (differs(T[zpos], back[k])) modified = true;
         }
+        #pragma omp parallel for
+        for (STORAGE k = 0; k < n; k++) T[writerDst[k]] = back[k];
+        return modified;
+    }
 
+    // Dataflow graph over the writers: each one depends on the writers of the (at most two) cells it reads.
+    // Tarjan's algorithm over these predecessor edges completes components producers-first, which is already
+    // a topological order; a component's level is one past the deepest level it reads from.
+    void buildLevels() {
+        buildWriters();
+        STORAGE* T = prog.tape.data;
+        STORAGE n = writers.size();
+        vector<STORAGE> owner(prog.tape_pos, -1);
+        for (STORAGE k = 0; k < n; k++) owner[writerDst[k]] = k;
+        vector<array<STORAGE,2>> preds(n);
+        for (STORAGE k = 0; k < n; k++) {
+            auto [a, b] = sources(T, writers[k]);
+            preds[k] = {a >= 0 ? owner[a] : -1, b >= 0 ? owner[b] : -1};
+        }
+        vector<STORAGE> index(n, -1), low(n), comp(n, -1), stack;
+        vector<pair<STORAGE,int>> call;
+        STORAGE counter = 0, ncomp = 0;
+        vector<STORAGE> order; // members grouped by component, components in completion order
+        compStart.assign(1, 0);
+        auto visit = [&](STORAGE v) { index[v] = low[v] = counter++; stack.push_back(v); call.push_back({v, 0}); };
+        for (STORAGE root = 0; root < n; root++) if (index[root] < 0) {
+            visit(root);
+            while (!call.empty()) {
+                STORAGE v = call.back().first;
+                if (call.back().second < 2) {
+                    STORAGE w = preds[v][call.back().second++];
+                    if (w < 0) continue;
+                    if (index[w] < 0) visit(w);
+                    else if (comp[w] < 0) low[v] = min(low[v], index[w]);
+                    continue;
+                }
+                call.pop_back();
+                if (!call.empty()) low[call.back().first] = min(low[call.back().first], low[v]);
+                if (low[v] != index[v]) continue;
+                size_t first = order.size();
+                STORAGE w;
+                do { w = stack.back(); stack.pop_back(); comp[w] = ncomp; order.push_back(w); } while (w != v);
+                sort(order.begin()+first, order.end(), [&](STORAGE x, STORAGE y){ return writers[x] < writers[y]; });
+                compStart.push_back(order.size());
+                ncomp++;
+            }
+        }
+        compMembers = std::move(order);
+        compCyclic.assign(ncomp, 0);
+        compIterations.assign(ncomp, 0);
+        vector<STORAGE> level(ncomp, 0);
+        levels.clear();
+        for (STORAGE c = 0; c < ncomp; c++) {
+            if (compStart[c+1]-compStart[c] > 1) compCyclic[c] = 1;
+            for (STORAGE m = compStart[c]; m < compStart[c+1]; m++)
+                for (STORAGE p : preds[compMembers[m]]) if (p >= 0) {
+                    if (comp[p] == c) compCyclic[c] = 1;
+                    else level[c] = max(level[c], level[comp[p]]+1);
+                }
+            if ((size_t)level[c] >= levels.size()) levels.resize(level[c]+1);
+            levels[level[c]].push_back(c);
+        }
+    }
+
+    // One pass over the levels: acyclic components run once, cyclic ones iterate in tape order until they settle.
+    bool step_levels() noexcept {
+        STORAGE* T = prog.tape.data;
+        bool exceeded = false;
+        for (auto& lvl : levels) {
+            STORAGE n = lvl.size();
+            #pragma omp parallel for schedule(dynamic, 64) reduction(||:exceeded)
+            for (STORAGE k = 0; k < n; k++) {
+                STORAGE c = lvl[k];
+                bool changed = true;
+                STORAGE iterations = 0;
+                while (changed && iterations < (compCyclic[c] ? maxloops : 1)) {
+                    changed = false;
+                    for (STORAGE m = compStart[c]; m < compStart[c+1]; m++) if (exec(T, writers[compMembers[m]]) >= 0) changed = true;
+                    iterations++;
+                }
+                compIterations[c] = iterations;
+                if (changed && compCyclic[c]) exceeded = true;
+            }
+        }
+        cycleExceeded = exceeded;
+        return false;
+    }
+
+    // Cyclic components with the most iterations, named after their first written cell.
+    string cycleReport(size_t top = 10) const {
+        vector<STORAGE> cyclic;
+        for (size_t c = 0; c < compCyclic.size(); c++) if (compCyclic[c]) cyclic.push_back(c);
+        sort(cyclic.begin(), cyclic.end(), [&](STORAGE x, STORAGE y){ return compIterations[x] > compIterations[y]; });
+        std::ostringstream out;
+        for (size_t k = 0; k < cyclic.size() && k < top; k++) {
+            STORAGE c = cyclic[k];
+            out << "Cycle " << prog.labelOf(writerDst[compMembers[compStart[c]]]) << " (" << compStart[c+1]-compStart[c]
+                << " instructions): " << compIterations[c] << " loops\n";
+        }
+        if (cyclic.size() > top) out << "... and " << cyclic.size()-top << " more cycles\n";
+        return out.str();
+    }
+
+    // Array engine: one tape instruction runs a vectorized, multithreaded loop over whole arrays. Scalar operands
+    // broadcast with a zero stride, and an instruction is skipped while none of its operands or its target changed.
+    template <STORAGE OP>
+    static bool elementwise(double* Z, const double* A, STORAGE sa, const double* B, STORAGE sb, STORAGE n) noexcept {
+        int changed = 0;
+        #pragma omp parallel for simd reduction(|:changed) if(n >= 65536)
+        for (STORAGE k = 0; k < n; k++) {
+            STORAGE r = compute<OP>(fromd(A[k*sa]).i, fromd(B[k*sb]).i);
+            changed |= differs(fromd(Z[k]).i, r);
+            Z[k] = fromi(r).d;
+        }
+        return changed;
+    }
+    static double reduce(STORAGE op, const double* A, STORAGE n) noexcept {
+        double acc = op == 0x09 ? 0.0 : op == 0x0A ? INFINITY : -INFINITY;
+        if (op == 0x09) {
+            // Fixed chunks summed in index order, so the rounding does not depend on the thread count.
+            const STORAGE chunk = 16384, chunks = (n+chunk-1)/chunk;
+            vector<double> part(chunks, 0.0);
+            #pragma omp parallel for if(n >= 65536)
+            for (STORAGE c = 0; c < chunks; c++) {
+                double s = 0.0;
+                #pragma omp simd reduction(+:s)
+                for (STORAGE k = c*chunk; k < min(n, (c+1)*chunk); k++) s += A[k];
+                part[c] = s;
+            }
+            for (double s : part) acc += s;
+        }
+        else if (op == 0x0A) {
+            #pragma omp parallel for simd reduction(min:acc) if(n >= 65536)
+            for (STORAGE k = 0; k < n; k++) acc = A[k] < acc ? A[k] : acc;
+        }
+        else {
+            #pragma omp parallel for simd reduction(max:acc) if(n >= 65536)
+            for (STORAGE k = 0; k < n; k++) acc = A[k] > acc ? A[k] : acc;
+        }
+        return acc;
+    }
+    uint64_t versionOf(STORAGE cell) const { return prog.iscall[cell] == 3 ? prog.arrays[prog.tape[cell]].version : (uint64_t)prog.tape[cell]; }
+
+    void buildArrays() {
+        arrayOps.clear();
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 4) arrayOps.push_back(i);
+        arraySeen.assign(arrayOps.size(), {~0ull, ~0ull, ~0ull});
+    }
+
+    // Runs the k-th array instruction and returns the cell it changed, or -1.
+    STORAGE runArray(size_t k) noexcept {
+        STORAGE* T = prog.tape.data;
+        STORAGE i = arrayOps[k], op = T[i];
+        STORAGE dst = op == 0x05 ? T[i+1] : i-1, a = op == 0x05 ? T[i+2] : T[i+1], b = T[i+2];
+        array<uint64_t,3> seen = {versionOf(a), versionOf(b), versionOf(dst)};
+        if (seen == arraySeen[k]) return -1;
+        bool changed;
+        if (op >= 0x09) {
+            STORAGE r = fromd(reduce(op, prog.array(T[a]), prog.arrays[T[a]].length)).i;
+            changed = differs(T[dst], r);
+            T[dst] = r;
+        } else {
+            double sa = fromi(T[a]).d, sb = fromi(T[b]).d;
+            const double* A = prog.iscall[a] == 3 ? prog.array(T[a]) : &sa;
+            const double* B = prog.iscall[b] == 3 ? prog.array(T[b]) : &sb;
+            STORAGE stepA = prog.iscall[a] == 3, stepB = prog.iscall[b] == 3, n = prog.arrays[T[dst]].length;
+            double* Z = prog.array(T[dst]);
+            if (op == 0x02) changed = elementwise<0x02>(Z, A, stepA, B, stepB, n);
+            else if (op == 0x03) changed = elementwise<0x03>(Z, A, stepA, B, stepB, n);
+            else if (op == 0x07) changed = elementwise<0x07>(Z, A, stepA, B, stepB, n);
+            else if (op == 0x08) changed = elementwise<0x08>(Z, A, stepA, B, stepB, n);
+            else changed = elementwise<0x05>(Z, A, stepA, B, stepB, n);
+            if (changed) __atomic_add_fetch(&prog.arrays[T[dst]].version, 1, __ATOMIC_RELAXED);
+        }
+        seen[2] = versionOf(dst);
+        arraySeen[k] = seen;
+        return changed ? dst : -1;
+    }
+
+    bool step_arrays() noexcept {
+        bool modified = false;
+        for (size_t k = 0; k < arrayOps.size(); k++) {
+            STORAGE z = runArray(k);
+            if (z < 0) continue;
+            modified = true;
+            if (mode == "worklist" && checkOscillation) dirty.push_back(z);
+            if (mode == "worklist" && prog.iscall[z] != 3)
+                for (STORAGE u = userStart[z]; u < userStart[z+1]; u++)
+                    if (!queued[users[u]]) { queued[users[u]] = 1; pending.push_back(users[u]); }
+        }
+        return modified;
+    }
+
+    bool step() {
+        bool modified = step_mode();
+        if (!arrayOps.empty()) modified = step_arrays() || modified;
         return modified;
     }
 
+    void buildWritten() {
+        const STORAGE* T = prog.tape.data;
+        vector<char> seen(prog.tape_pos, 0);
+        written.clear();
+        for (STORAGE i = 0; i < prog.tape_pos; i++) {
+            STORAGE z = -1, r;
+            if (prog.iscall[i] == 1) { if (!evaluate(T, i, z, r)) continue; }
+            else if (prog.iscall[i] == 4) z = T[i] == 0x05 ? T[i+1] : i-1;
+            else continue;
+            if (!seen[z]) { seen[z] = 1; written.push_back(z); }
+        }
+        hashed.assign(prog.tape_pos, 0);
+        hash = 0;
+        for (STORAGE c : written) { hashed[c] = T[c]; hash += cellHash(c, T[c]); }
+        dirty.clear();
+        savedLoop = period = 0;
+        culprits.clear();
+    }
+
+
+    // Worklist state also includes the queue; arrays only contribute their versions, which never repeat.
+    uint64_t stateHash() noexcept {
+        const STORAGE* T = prog.tape.data;
+        uint64_t delta = 0;
+        if (mode == "worklist") {
+            for (STORAGE c : dirty) if (T[c] != hashed[c]) { delta += cellHash(c, T[c])-cellHash(c, hashed[c]); hashed[c] = T[c]; }
+            dirty.clear();
+        } else {
+            size_t n = written.size();
+            #pragma omp parallel for reduction(+:delta) if(n >= 65536)
+            for (size_t k = 0; k < n; k++) {
+                STORAGE c = written[k];
+                if (T[c] != hashed[c]) { delta += cellHash(c, T[c])-cellHash(c, hashed[c]); hashed[c] = T[c]; }
+            }
+        }
+        hash += delta;
+        uint64_t h = hash;
+        for (const auto& a : prog.arrays) h += hashMix(a.version+a.offset);
+        if (mode == "worklist") for (STORAGE i : pending) h += hashMix(~i);
+        return h;
+    }
+
+    bool sameState() const noexcept {
+        const STORAGE* T = prog.tape.data;
+        for (size_t k = 0; k < written.size(); k++) if (T[written[k]] != savedState[k]) return false;
+        return true;
+    }
+
+    // Called after every loop. On a repeat, runs up to one more period and keeps the cells that moved in it. Cells
+    // that several instructions set to different values within a loop can end every loop unchanged (period 1), so
+    // an ordered pass from the repeated state also records every cell written with a new value, then is undone.
+    bool oscillating() {
+        if (loops < 16) return false;
+        uint64_t h = stateHash();
+        if (savedLoop && h == savedHash && sameState()) {
+            period = loops-savedLoop;
+            const STORAGE* T = prog.tape.data;
+            vector<char> moved(written.size(), 0);
+            for (STORAGE k = 0; k < min<STORAGE>(period, 256) && loops < maxloops; k++) {
+                step();
+                loops++;
+                if (profile) profileLoop();
+                for (size_t c = 0; c < written.size(); c++) moved[c] |= T[written[c]] != savedState[c];
+            }
+            STORAGE* W = prog.tape.data;
+            vector<STORAGE> before(written.size());
+            for (size_t c = 0; c < written.size(); c++) before[c] = W[written[c]];
+            vector<char> rewritten(prog.tape_pos, 0);
+            for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1) {
+                STORAGE z = exec(W, i);
+                if (z >= 0) rewritten[z] = 1;
+            }
+            for (size_t c = 0; c < written.size(); c++) W[written[c]] = before[c];
+            for (size_t c = 0; c < written.size(); c++) if (moved[c] || rewritten[written[c]]) culprits.push_back(written[c]);
+            return true;
+        }
+        if (loops >= 2*savedLoop) {
+            savedHash = h;
+            savedLoop = loops;
+            savedState.resize(written.size());
+            for (size_t k = 0; k < written.size(); k++) savedState[k] = prog.tape[written[k]];
+        }
+        return false;
+    }
+
+    string oscillationReport() const {
+        std::ostringstream out;
+        out << "Oscillating with period " << period << ":";
+        size_t top = min<size_t>(culprits.size(), 8);
+        for (size_t k = 0; k < top; k++) out << (k ? ", " : " ") << prog.labelOf(culprits[k]);
+        if (culprits.size() > top) out << " and " << culprits.size()-top << " more cells";
+        out << "\n";
+        return out.str();
+    }
+
+    bool step_mode() {
+        if (mode == "pool") return pool->step();
+        if (mode == "levels") return step_levels();
+        if (mode == "jacobi") return step_jacobi();
+        if (mode == "seq") return profile ? step_seq<true>() : step_seq<false>();
+        if (mode == "worklist") return step_worklist();
+        if (mode == "simd") return step_simd();
+        return profile ? step_once<true>() : step_once<false>();
+    }
+
 
-    void run() noexcept {
+    void run() {
         using clock = std::chrono::high_resolution_clock;
         auto start = clock::now();
-        cout << "\033[2J\n"; // clear screen first
+        if (mode == "worklist") buildUsers();
+        else if (mode == "simd") { lowered.lower(prog); kernel = pickKernel(simd, lowered, prog.tape.data, prog.tape_pos); }
+        else if (mode == "jacobi") buildWriters();
+        else if (mode == "levels") buildLevels();
+        else if (mode == "pool") pool = make_unique<WorkerPool>(prog, threads, serialBelow);
+        else if (mode == "shard") {
+            if (prog.tape.fd < 0) prog.tape.mapShared(prog.tape_pos);
+            if (profile) throw runtime_error("--profile is not supported with --mode=shard");
+            shards = make_unique<Shards>(prog, processes, maxloops, checkOscillation);
+        }
+        else if (mode != "sweep" && mode != "seq") throw runtime_error("Unknown mode: "+mode);
+        buildArrays();
+        if (checkOscillation || profile) buildWritten();
+        if (profile) {
+            prof = Profile();
+            prof.changes.assign(written.size(), 0);
+            for (STORAGE c : written) prof.previous.push_back(prog.tape[c]);
+            prof.startTicks = ticks();
+        }
+        unique_ptr<Output> output;
+        if (!quiet) output = make_unique<Output>(prog, *console, tty < 0 ? console == &cout && isatty(1) : tty, refresh, sinks);
         bool running = true;
-        STORAGE loops = 0;
-        const STORAGE maxloops = 100000;
+        loops = 0;
+        if (shards) {
+            loops = shards->wait();
+            period = shards->control->period;
+            for (STORAGE c = 0; c < shards->cells; c++) if (shards->culprit[c]) culprits.push_back(c);
+            running = false;
+        }
         while(running) {
-            running = step_once();
+            running = step();
             loops++;
-            if(loops >= maxloops) running = false;
-            if(!running || loops %1000==0) { // affect the console at regular intervals
-                std::ostringstream out;
-                unordered_map<int, vector<string>> streamCaches;
-                for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1 && prog.tape[i] == 0x04) {
-                    i++;STORAGE loc = prog.tape[i];i++;STORAGE streamTarget = prog.tape[i]-16;
-                    string out;
-                    if (prog.iscall[loc] == 2) {
-                        while (prog.tape[loc]) {out += (char)prog.tape[loc];++loc;}
-                    } else out = to_string(fromi(prog.tape[loc]).d);
-                    streamCaches[streamTarget].push_back(move(out));
-                }
-                out << "\033[2J\033[H";
-                for (auto &[id, vec] : streamCaches) if(id==0) for(auto &item : vec) out << item;
-                out << "\n";
-                auto now = clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
-                if (loops >= maxloops) out << "Exceeded max loops (" << maxloops << " loops, "<<elapsed<<"ms)\n";
-                else if(running) out << "Running (terminate with ctrl+c)\n";
-                else out << "Done (" << loops << " loops, "<<elapsed<<"ms)\n";
-                cout << out.str();
+            if (profile) profileLoop();
+            if(loops >= maxloops || cycleExceeded) running = false;
+            else if(running && checkOscillation && oscillating()) running = false;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+        pool.reset();
+        shards.reset();
+        if (profile) {
+            prof.endTicks = ticks();
+            prof.ms = chrono::duration<double, milli>(clock::now()-start).count();
+            if (!profileJson.empty()) {
+                ofstream f(profileJson);
+                if (!f) throw runtime_error("Cannot open "+profileJson);
+                f << prof.json(prog, written, mode, loops);
+            }
+        }
+        if (!output) return;
+        std::ostringstream out;
+        if (mode == "levels") out << cycleReport();
+        if (period) out << oscillationReport() << "Stopped oscillating run (" << loops << " loops, "<<elapsed<<"ms)\n";
+        else if (cycleExceeded) out << "Exceeded max loops in a cycle (" << maxloops << " loops, "<<elapsed<<"ms)\n";
+        else if (loops >= maxloops) out << "Exceeded max loops (" << maxloops << " loops, "<<elapsed<<"ms)\n";
+        else if (mode == "sweep") out << "Done (" << loops << " loops, "<<elapsed<<"ms)\n";
+        else out << "Done (" << loops << " " << mode << " loops, "<<elapsed<<"ms)\n";
+        if (profile) out << prof.text(prog, written, mode, loops);
+        output->finish(out.str());
+    }
+};
+
+// Ensemble runs: one program over many input rows. Instances are grouped into blocks of `lanes`, each block keeps
+// the cells the program touches as [cell][lane] so every instruction runs as one simd loop across the block, and
+// blocks converge independently on their own threads. Cells named by the inputs are pinned: instructions that
+// write them are dropped so the row value holds for the whole run.
+struct Batch {
+    static const int lanes = 64;
+    struct Op { STORAGE op, z, a, b; };
+    const Program& prog;
+    vector<string> names;           // input column names
+    vector<STORAGE> inputs;         // input column cells
+    vector<vector<double>> rows;
+    vector<STORAGE> outputs;        // streamed number cells, in stream order
+    vector<STORAGE> slot;           // cell -> dense slot, or -1
+    vector<STORAGE> cells;          // slot -> cell
+    vector<Op> ops;                 // in dense slots
+    vector<double> results;         // [instance][output]
+    vector<STORAGE> converged;      // loops until the instance stopped changing, or -1
+    STORAGE maxloops = 100000;
+
+    Batch(const Program& prog) : prog(prog) {}
+
+    void read(const string& path) {
+        ifstream f(path);
+        if (!f) throw runtime_error("Cannot open "+path);
+        auto split = [](const string& line) {
+            vector<string> fields;
+            stringstream ss(line);
+            for (string field; getline(ss, field, ',');) {
+                size_t b = field.find_first_not_of(" \t\r"), e = field.find_last_not_of(" \t\r");
+                fields.push_back(b == string::npos ? "" : field.substr(b, e-b+1));
+            }
+            return fields;
+        };
+        string line;
+        if (!getline(f, line)) throw runtime_error("Empty batch file: "+path);
+        names = split(line);
+        for (size_t n = 2; getline(f, line); n++) {
+            if (line.find_first_not_of(" \t\r") == string::npos) continue;
+            auto fields = split(line);
+            if (fields.size() != names.size()) throw runtime_error(path+":"+to_string(n)+": expected "+to_string(names.size())+" values");
+            vector<double> row;
+            for (auto& field : fields) {
+                char* end;
+                row.push_back(strtod(field.c_str(), &end));
+                if (field.empty() || *end) throw runtime_error(path+":"+to_string(n)+": not a number: "+field);
+            }
+            rows.push_back(std::move(row));
+        }
+    }
+
+    STORAGE use(STORAGE cell) {
+        if (slot[cell] < 0) { slot[cell] = cells.size(); cells.push_back(cell); }
+        return slot[cell];
+    }
+
+    void build() {
+        const STORAGE* T = prog.tape.data;
+        for (STORAGE i = 0; i < prog.tape_pos; i++)
+            if (prog.iscall[i] >= 3) throw runtime_error("--batch does not support arrays");
+        slot.assign(prog.tape_pos, -1);
+        vector<char> pinned(prog.tape_pos, 0);
+        for (STORAGE c : inputs) { pinned[c] = 1; use(c); }
+        for (STORAGE i = 0; i < prog.tape_pos; i++) {
+            if (prog.iscall[i] != 1) continue;
+            STORAGE z, r;
+            if (T[i] == 0x04 && prog.iscall[T[i+1]] != 2) outputs.push_back(T[i+1]);
+            if (!evaluate(T, i, z, r) || pinned[z]) continue;
+            auto [a, b] = sources(T, i);
+            ops.push_back({T[i], use(z), use(a), use(b < 0 ? a : b)});
+        }
+        for (STORAGE c : outputs) use(c);
+    }
+
+    template <STORAGE OP>
+    static void lane(STORAGE* Z, const STORAGE* A, const STORAGE* B, uint8_t* changed) noexcept {
+        #pragma omp simd
+        for (int l = 0; l < lanes; l++) {
+            STORAGE r = compute<OP>(A[l], B[l]);
+            changed[l] |= differs(Z[l], r);
+            Z[l] = r;
+        }
+    }
+
+    void runBlock(size_t first) {
+        size_t count = min<size_t>(lanes, rows.size()-first);
+        vector<STORAGE> V(cells.size()*lanes);
+        for (size_t c = 0; c < cells.size(); c++) fill_n(&V[c*lanes], lanes, prog.tape[cells[c]]);
+        for (size_t k = 0; k < count; k++)
+            for (size_t n = 0; n < inputs.size(); n++) V[slot[inputs[n]]*lanes+k] = fromd(rows[first+k][n]).i;
+        uint8_t changed[lanes], done[lanes];
+        for (int l = 0; l < lanes; l++) done[l] = (size_t)l >= count;
+        size_t active = count;
+        for (STORAGE loop = 1; active && loop <= maxloops; loop++) {
+            memset(changed, 0, sizeof(changed));
+            for (const Op& o : ops) {
+                STORAGE *Z = &V[o.z*lanes], *A = &V[o.a*lanes], *B = &V[o.b*lanes];
+                if (o.op == 0x02) lane<0x02>(Z, A, B, changed);
+                else if (o.op == 0x03) lane<0x03>(Z, A, B, changed);
+                else if (o.op == 0x07) lane<0x07>(Z, A, B, changed);
+                else if (o.op == 0x08) lane<0x08>(Z, A, B, changed);
+                else lane<0x05>(Z, A, A, changed);
             }
+            for (size_t k = 0; k < count; k++) if (!done[k] && !changed[k]) { done[k] = 1; converged[first+k] = loop; active--; }
+        }
+        for (size_t k = 0; k < count; k++)
+            for (size_t n = 0; n < outputs.size(); n++) results[(first+k)*outputs.size()+n] = fromi(V[slot[outputs[n]]*lanes+k]).d;
+    }
+
+    void run() {
+        results.assign(rows.size()*outputs.size(), 0);
+        converged.assign(rows.size(), -1);
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t first = 0; first < rows.size(); first += lanes) runBlock(first);
+    }
+
+    // One CSV row per instance: its inputs, the streamed numbers and the loops it needed ("max" if it never settled).
+    void write(ostream& out) const {
+        out << "instance";
+        for (auto& name : names) out << "," << name;
+        for (STORAGE c : outputs) out << "," << prog.labelOf(c);
+        out << ",loops\n";
+        char number[32];
+        for (size_t k = 0; k < rows.size(); k++) {
+            out << k;
+            for (double v : rows[k]) { snprintf(number, sizeof(number), "%f", v); out << "," << number; }
+            for (size_t n = 0; n < outputs.size(); n++) { snprintf(number, sizeof(number), "%f", results[k*outputs.size()+n]); out << "," << number; }
+            if (converged[k] < 0) out << ",max\n"; else out << "," << converged[k] << "\n";
         }
     }
 };
@@ -126,6 +1683,14 @@ struct Parser {
     STORAGE depth=0;
     Program prog;
     Parser(string src):s((src)){}
+    size_t linePos=0;
+    STORAGE lineNo=1;
+    STORAGE line(){
+        if(i<linePos){ linePos=0; lineNo=1; }
+        lineNo += count(s.begin()+linePos, s.begin()+min(i, s.size()), '\n');
+        linePos = min(i, s.size());
+        return lineNo;
+    }
     void skipWS(){
         while(i<s.size()){
             char c=s[i];
@@ -135,54 +1700,90 @@ struct Parser {
         }
     }
 
+    // Member lookup index: each interned name keeps its labels in declaration order, so the first one after a scope's
+    // label is a binary search, and nextShallower links each label to the next one declared at a smaller depth, so the
+    // depth cutoff of a lookup skips whole nested runs at once. A declaration costs the same at any nesting depth.
+    deque<string> names;
+    unordered_map<string_view,int> nameIds;
+    vector<vector<STORAGE>> occurrences;       // interned name -> its labels, ascending
+    vector<STORAGE> nextShallower; // label -> next label with a smaller depth, -1 while there is none
+    vector<STORAGE> waiting;       // labels without a shallower successor yet, depths ascending
+    int intern(string_view name) {
+        auto it = nameIds.find(name);
+        if (it != nameIds.end()) return it->second;
+        names.emplace_back(name);
+        occurrences.emplace_back();
+        return nameIds.emplace(names.back(), names.size()-1).first->second;
+    }
+
     void addLabel(const string &name) {
-        prog.lastLabel[name] = prog.labels.size();
-        prog.labels.push_back({name, prog.tape_pos, depth});
+        addRenamedLabel(name, prog.tape_pos);
     }
     void addRenamedLabel(const string &name, STORAGE redirect) {
-        prog.lastLabel[name] = prog.labels.size();
-        prog.labels.push_back({name, redirect, depth});
+        STORAGE label = prog.labels.size();
+        prog.lastLabel[name] = label;
+        prog.labels.push_back({name, redirect, depth, line()});
+        nextShallower.push_back(-1);
+        for (; !waiting.empty() && prog.labels[waiting.back()].depth > depth; waiting.pop_back()) nextShallower[waiting.back()] = label;
+        waiting.push_back(label);
+        if (name == "__") return;
+        occurrences[intern(name)].push_back(label);
+    }
+
+    // First label named `part` after label `scope` and before label `stop`, or -1.
+    STORAGE member(STORAGE scope, string_view part, STORAGE stop) const {
+        auto id = nameIds.find(part);
+        if (id == nameIds.end()) return -1;
+        const auto& labels = occurrences[id->second];
+        auto it = upper_bound(labels.begin(), labels.end(), scope);
+        return it != labels.end() && *it < stop ? *it : -1;
     }
 
     bool matchChar(char c){ skipWS(); if(i<s.size() && s[i]==c){ i++; return true;} return false; }
     bool peekChar(char c){ skipWS(); return i<s.size() && s[i]==c; }
 
-    optional<string> parseIdent(){
+    optional<string_view> parseIdent(){
         skipWS(); size_t j=i;
         if(j<s.size() && isIdentStart(s[j])){
             j++; while(j<s.size() && isIdent(s[j])) j++;
-            string id = s.substr(i, j-i); i=j; return id;
+            string_view id = string_view(s).substr(i, j-i); i=j; return id;
         }
         return nullopt;
     }
 
-    // Scoped identifier like a.b.c
+    // Scoped identifier like a.b.c, copied from the source in one piece unless whitespace separates its parts
     optional<string> parseScopedIdent(){
         skipWS();
-        auto id = parseIdent();
-        if(!id) return nullopt;
-        string name=*id;
+        size_t start=i;
+        if(!parseIdent()) return nullopt;
+        while(i+1<s.size() && s[i]=='.' && isIdentStart(s[i+1])){ i++; parseIdent(); }
+        string name = s.substr(start, i-start);
         while(peekChar('.')){
             matchChar('.');
             auto sub = parseIdent();
             if(!sub) throw runtime_error("Expected sub-identifier after '.'");
-            name += "." + *sub;
+            name += ".";
+            name += *sub;
         }
         return name;
     }
 
-    optional<long long> parseNumber(){
+    optional<double> parseNumber(){
         skipWS(); size_t j=i; if(j>=s.size()) return nullopt;
         if(!(isdigit((unsigned char)s[j]) || s[j]=='-' || s[j]=='+')) return nullopt;
         size_t k=j+1; while(k<s.size() && isdigit((unsigned char)s[k])) k++;
-        long long val = stoll(s.substr(i, k-i)); i=k; return val;
+        if(k+1<s.size() && s[k]=='.' && isdigit((unsigned char)s[k+1])){ k++; while(k<s.size() && isdigit((unsigned char)s[k])) k++; }
+        double val = stod(s.substr(i, k-i)); i=k; return val;
     }
 
-    bool parseString(STORAGE &tape_pos) {
+    unordered_map<string,STORAGE> interned; // string literal -> handle in prog.strings
+
+    // Reads a string literal into the pool, storing identical literals once, and returns its handle.
+    STORAGE parseStringHandle() {
         skipWS();
-        if (i >= s.size() || s[i] != '"') return false;
+        if (i >= s.size() || s[i] != '"') throw runtime_error("Expected string literal");
         i++; // opening quote
-        STORAGE start = tape_pos;
+        string text;
         while (i < s.size() && s[i] != '"') {
             unsigned char ch;
             if (s[i] == '\\') { // escape sequence
@@ -203,63 +1804,69 @@ struct Parser {
             } else {
                 ch = (unsigned char) s[i++];
             }
-            prog.tape[tape_pos] = ch;
-            prog.iscall[tape_pos] = 0;
-            tape_pos++;
+            text += (char)ch;
         }
         if (i >= s.size() || s[i] != '"') throw runtime_error("Unterminated string literal");
         i++; // closing quote
-        prog.tape[tape_pos] = 0x00;
-        prog.iscall[tape_pos] = 0;
-        tape_pos++;
-        prog.iscall[start] = 2; // do this only now, in case string is empty
+        auto [it, added] = interned.emplace(text, (STORAGE)prog.strings.size());
+        if (added) { prog.strings += text; prog.strings += '\0'; }
+        return it->second;
+    }
+
+    bool parseString() {
+        skipWS();
+        if (i >= s.size() || s[i] != '"') return false;
+        prog.emit(parseStringHandle(), 2);
         return true;
     }
 
-    // Resolve dotted name
+    // Resolve dotted name: the head is the latest label with that name, and the p-th further part the first label
+    // with its name after the previous one, as long as no label in between is shallower than depth+p-1.
     STORAGE resolveScoped(const string& token){
-        if(prog.lastLabel.count(token)) {
-            if(prog.labels[prog.lastLabel[token]].depth>depth) throw runtime_error("Symbol not in scope, or it has been shadowed: "+token);
-            return prog.labels[prog.lastLabel[token]].tape_index;
+        auto last = prog.lastLabel.find(token);
+        if(last!=prog.lastLabel.end()) {
+            if(prog.labels[last->second].depth>depth) throw runtime_error("Symbol not in scope, or it has been shadowed: "+token);
+            return prog.labels[last->second].tape_index;
         }
 
-        vector<string> parts;
-        string cur;
-        for(char c:token){ if(c=='.'){ parts.push_back(cur); cur.clear(); } else cur.push_back(c); }
-        if(!cur.empty()) parts.push_back(cur);
-        if(parts.empty()) throw runtime_error("Empty identifier");
-
-        STORAGE found=-1;
-        for(STORAGE k=(int)prog.labels.size()-1;k>=0;k--) if(prog.labels[k].name==parts[0]){found=k; break;}
-        if(found==-1) throw runtime_error("Unknown symbol: "+parts[0]);
-        if(prog.labels[found].depth>depth) throw runtime_error("Symbol not in scope, or it has been shadowed: "+parts[0]);
-        STORAGE idx = prog.labels[found].tape_index;
-        for(size_t p=1;p<parts.size();++p){
-            bool ok=false;
-            for(STORAGE k=found+1;k<(int)prog.labels.size();k++){
-                if(prog.labels[k].depth<depth+(int)p-1) break;
-                if(prog.labels[k].name==parts[p]){idx=prog.labels[k].tape_index; found=k; ok=true; break;}
-            }
-            if(!ok) throw runtime_error("Unknown sub-element: "+parts[p]);
+        string_view rest(token);
+        size_t dot = rest.find('.');
+        string head(rest.substr(0, dot));
+        if(head.empty()) throw runtime_error("Empty identifier");
+        auto it = prog.lastLabel.find(head);
+        if(it==prog.lastLabel.end()) throw runtime_error("Unknown symbol: "+head);
+        STORAGE found = it->second;
+        if(prog.labels[found].depth>depth) throw runtime_error("Symbol not in scope, or it has been shadowed: "+head);
+        STORAGE n = prog.labels.size();
+        for(STORAGE p=1; dot!=string_view::npos; p++){
+            rest = rest.substr(dot+1);
+            dot = rest.find('.');
+            string_view part = rest.substr(0, dot);
+            STORAGE stop = found+1;
+            while(stop<n && prog.labels[stop].depth>=depth+p-1) stop = nextShallower[stop]<0 ? n : nextShallower[stop];
+            found = member(found, part, stop);
+            if(found<0) throw runtime_error("Unknown sub-element: "+string(part));
         }
-        return idx;
+        return prog.labels[found].tape_index;
     }
 
-    vector<STORAGE> parseArgList(STORAGE &tape_pos){
+    vector<pair<STORAGE,TAG>> literals; // number and string arguments of the call being parsed
+    vector<STORAGE> parseArgList(){
         vector<STORAGE> args;
         if(!matchChar('(')) throw runtime_error("Expected '('");
         while(true){
             skipWS(); if(i>=s.size()) throw runtime_error("Unterminated arg list");
             if(s[i]=='"'){
-                args.push_back(tape_pos);
-                parseString(tape_pos);
+                args.push_back(-1-(STORAGE)literals.size()); // placed after the call by encodeCall
+                literals.push_back({parseStringHandle(), 2});
             } else if(isIdentStart(s[i])) {
                 auto id = parseScopedIdent();
                 args.push_back(resolveScoped(*id));
             } else {
                 auto n = parseNumber();
                 if(!n.has_value()) throw runtime_error("Expected arg");
-                args.push_back(fromd((double)(int)*n).i);
+                args.push_back(-1-(STORAGE)literals.size()); // placed after the call by encodeCall
+                literals.push_back({fromd(*n).i, 0});
             }
             skipWS();
             if(peekChar(')')){ i++; break; }
@@ -268,28 +1875,77 @@ struct Parser {
         return args;
     }
 
+    // Common length of the array arguments, or -1 if there are none.
+    STORAGE arrayLength(const vector<STORAGE>& args){
+        STORAGE length = -1;
+        for(STORAGE a:args) if(a>=0 && prog.iscall[a]==3){
+            STORAGE n = prog.arrays[prog.tape[a]].length;
+            if(length>=0 && n!=length) throw runtime_error("Array lengths differ: "+to_string(length)+" and "+to_string(n));
+            length = n;
+        }
+        return length;
+    }
+
     void encodeCall(const string& sym, STORAGE opcode, const vector<STORAGE>& args){
         //STORAGE start = prog.tape_pos;
-        prog.iscall[prog.tape_pos] = 0;
-        prog.tape[prog.tape_pos++] = 0;
-        prog.iscall[prog.tape_pos] = 1;
-        prog.tape[prog.tape_pos++] = opcode;
+        bool arithmetic = opcode==0x02 || opcode==0x03 || opcode==0x07 || opcode==0x08;
+        STORAGE length = arithmetic || opcode>=0x09 ? arrayLength(args) : -1;
+        if(opcode>=0x09 && length<0) throw runtime_error(sym+" requires an array argument");
+        if(length>=0 && arithmetic) prog.emit(prog.newArray(length, 0), 3); // elementwise result
+        else prog.emit(0, 0);
+        prog.emit(opcode, length>=0 ? 4 : 1);
         if(opcode==0x01){ // >name
             STORAGE destLoc = resolveScoped(sym);
-            prog.iscall[prog.tape_pos] = 0;
-            prog.tape[prog.tape_pos++] = destLoc;
+            prog.emit(destLoc, 0);
+        }
+        STORAGE operands = prog.tape_pos;
+        for(STORAGE a:args) prog.emit(a, 0);
+        // literal arguments get their own cells after the call, so that a label before the call still names its result
+        for(size_t k=0;k<args.size();k++) if(args[k]<0) {
+            prog.tape[operands+k] = prog.tape_pos;
+            prog.emit(literals[-1-args[k]].first, literals[-1-args[k]].second);
+        }
+        literals.clear();
+    }
+
+    // Builtins: array(length[, fill]) and load("path") create arrays, sum/min/max(array) reduce them.
+    void parseBuiltin(const string& fn){
+        auto args = parseArgList();
+        auto literal = [&](size_t k, TAG tag) {
+            if(k>=args.size() || args[k]>=0 || literals[-1-args[k]].second!=tag) throw runtime_error(fn+" expects a literal "+(tag==2?"string":"number")+" argument");
+            return literals[-1-args[k]].first;
+        };
+        if(fn=="array"){
+            if(args.size()<1 || args.size()>2) throw runtime_error("array requires a length and an optional fill value");
+            double length = fromi(literal(0, 0)).d, fill = args.size()>1 ? fromi(literal(1, 0)).d : 0.0;
+            if(length<0) throw runtime_error("Negative array length");
+            literals.clear();
+            prog.emit(prog.newArray((STORAGE)length, fill), 3);
         }
-        for(STORAGE a:args) {
-            prog.iscall[prog.tape_pos] = 0;
-            prog.tape[prog.tape_pos++] = a;
+        else if(fn=="load"){
+            if(args.size()!=1) throw runtime_error("load requires a file path");
+            string path(prog.str(literal(0, 2)));
+            literals.clear();
+            ifstream f(path);
+            if(!f) throw runtime_error("Cannot open "+path);
+            vector<double> values;
+            for(double v; f >> v;) values.push_back(v);
+            if(!f.eof()) throw runtime_error("Expected numbers in "+path);
+            STORAGE handle = prog.newArray(values.size(), 0);
+            copy(values.begin(), values.end(), prog.array(handle));
+            prog.emit(handle, 3);
         }
+        else if(fn=="sum" || fn=="min" || fn=="max"){
+            if(args.size()!=1) throw runtime_error(fn+" requires one argument");
+            args.push_back(args[0]);
+            encodeCall(fn, fn=="sum" ? 0x09 : fn=="min" ? 0x0A : 0x0B, args);
+        }
+        else throw runtime_error("Unknown builtin: "+fn);
     }
 
     void parse(){
         prog.streamIds["out"] = prog.nextStreamId++;
-        prog.tape[0] = 0;
-        prog.iscall[0] = 0;
-        prog.tape_pos++;
+        prog.emit(0, 0);
         while(i<s.size()){
             skipWS();
             if(i>=s.size()) break;
@@ -303,7 +1959,7 @@ struct Parser {
                     depth++;
                     continue;
                 }
-                if(s[i]==':' && i<s.size()-1 && s[i+1]!='=' && s[i+1]!='+' && s[i+1]!='*' && s[i+1]!='<' && s[i+1]!='^') throw runtime_error("Unexpected : must be followed by one of =+*");
+                if(s[i]==':' && i<s.size()-1 && s[i+1]!='=' && s[i+1]!='+' && s[i+1]!='*' && s[i+1]!='<' && s[i+1]!='^' && !isIdentStart(s[i+1])) throw runtime_error("Unexpected : must be followed by one of =+*^< or a builtin");
                 if(s[i]==':' && i<s.size()-1 && s[i+1]!='='){
                     i++;
                     addLabel(*id);
@@ -326,7 +1982,7 @@ struct Parser {
                     STORAGE rhsLoc;
                     if (s[i] == '"') {
                         STORAGE strStart = prog.tape_pos;
-                        parseString(prog.tape_pos);
+                        parseString();
                         rhsLoc = strStart;
                     } else if (isIdentStart(s[i])) {
                         auto rhs = parseScopedIdent();
@@ -337,9 +1993,7 @@ struct Parser {
                         if (!n) throw runtime_error("Expected RHS of ':='");
                         const string dummy="__";
                         addLabel(dummy);
-                        prog.tape[prog.tape_pos] = fromd((double)(int)*n).i;
-                        prog.iscall[prog.tape_pos] = 0;
-                        prog.tape_pos++;
+                        prog.emit(fromd(*n).i, 0);
                         rhsLoc = prog.labels[prog.lastLabel[dummy]].tape_index;
                     }
                     addRenamedLabel(lhs, rhsLoc);
@@ -353,7 +2007,7 @@ struct Parser {
                     STORAGE rhsLoc;
                     if (s[i] == '"') {
                         STORAGE strStart = prog.tape_pos;
-                        parseString(prog.tape_pos);
+                        parseString();
                         rhsLoc = strStart;
                     } else if (isIdentStart(s[i])) {
                         auto rhs = parseScopedIdent();
@@ -363,23 +2017,17 @@ struct Parser {
                         if (!n) throw runtime_error("Expected RHS of assignment");
                         string dummy="__";
                         addLabel(dummy);
-                        prog.tape[prog.tape_pos] = fromd((double)(int)*n).i;
-                        prog.iscall[prog.tape_pos] = 0;
-                        prog.tape_pos++;
+                        prog.emit(fromd(*n).i, 0);
                         rhsLoc = prog.labels[prog.lastLabel[dummy]].tape_index;
                     }
-                    prog.tape[prog.tape_pos] = 0;
-                    prog.iscall[prog.tape_pos] = 0;
-                    prog.tape_pos++;
-                    prog.tape[prog.tape_pos] = 0x05; // assignment opcode
-                    prog.iscall[prog.tape_pos] = 1;
-                    prog.tape_pos++;
-                    prog.tape[prog.tape_pos] = resolveScoped(*lhs);
-                    prog.iscall[prog.tape_pos] = 0;
-                    prog.tape_pos++;
-                    prog.tape[prog.tape_pos] = rhsLoc;
-                    prog.iscall[prog.tape_pos] = 0;
-                    prog.tape_pos++;
+                    STORAGE lhsLoc = resolveScoped(*lhs);
+                    bool array = prog.iscall[lhsLoc]==3;
+                    if(!array && prog.iscall[rhsLoc]==3) throw runtime_error("Cannot assign an array to a scalar: "+*lhs);
+                    if(array) arrayLength({lhsLoc, rhsLoc});
+                    prog.emit(0, 0);
+                    prog.emit(0x05, array ? 4 : 1); // assignment opcode, elementwise for arrays
+                    prog.emit(lhsLoc, 0);
+                    prog.emit(rhsLoc, 0);
                     continue;
                 }
                 i = save;
@@ -400,7 +2048,7 @@ struct Parser {
                     STORAGE rhsLoc;
                     if (s[i] == '"') {
                         STORAGE strStart = prog.tape_pos;
-                        parseString(prog.tape_pos);
+                        parseString();
                         rhsLoc = strStart;
                     } else if (isIdentStart(s[i])) {
                         auto rhs = parseScopedIdent();
@@ -411,9 +2059,7 @@ struct Parser {
                         if (!n) throw runtime_error("Expected RHS after '|'");
                         string dummy="__";
                         addLabel(dummy);
-                        prog.tape[prog.tape_pos] = fromd((double)(int)*n).i;
-                        prog.iscall[prog.tape_pos] = 0;
-                        prog.tape_pos++;
+                        prog.emit(fromd(*n).i, 0);
                         rhsLoc = prog.labels[prog.lastLabel[dummy]].tape_index;
                     }
 
@@ -426,48 +2072,707 @@ struct Parser {
                 i = save;
             }
 
+            if (isIdentStart(s[i])) {
+                size_t save = i;
+                auto fn = parseIdent();
+                if (peekChar('(')) { parseBuiltin(string(*fn)); continue; }
+                i = save;
+            }
+
             if (peekChar('|')) runtime_error("A stream name is expected at the LHS of |");
 
-            //if(peekChar('>')){ matchChar('>'); auto id=parseScopedIdent(); auto args=parseArgList(prog.tape_pos); encodeCall(*id,0x01,args); continue; prog.iscall[prog.tape_pos] = 0;prog.tape[prog.tape_pos++] = 0x00;}
+            //if(peekChar('>')){ matchChar('>'); auto id=parseScopedIdent(); auto args=parseArgList(); encodeCall(*id,0x01,args); continue; prog.iscall[prog.tape_pos] = 0;prog.tape[prog.tape_pos++] = 0x00;}
             if(peekChar('{')){ matchChar('{'); depth++;continue;}
             if(peekChar('}')){ matchChar('}'); depth--;if(depth<0) throw runtime_error("Imbalanced brackets - extra }");continue;}
-            if(peekChar('*')){ matchChar('*'); auto args=parseArgList(prog.tape_pos); if(args.size()!=2) throw runtime_error("* requires two arguments"); encodeCall("*",0x02,args); continue; }
-            if(peekChar('+')){ matchChar('+'); auto args=parseArgList(prog.tape_pos); if(args.size()!=2) throw runtime_error("+ requires two arguments");encodeCall("+",0x03,args); continue; }
-            if(peekChar('^')){ matchChar('^'); auto args=parseArgList(prog.tape_pos); if(args.size()!=2) throw runtime_error("+ requires two arguments");encodeCall("^",0x07,args); continue; }
-            if(peekChar('<')){ matchChar('<'); auto args=parseArgList(prog.tape_pos); if(args.size()!=2) throw runtime_error("+ requires two arguments");encodeCall("<",0x08,args); continue; }
-            if(peekChar('&')){ matchChar('&'); auto args=parseArgList(prog.tape_pos); if(args.size()!=1) throw runtime_error("& requires one argument");
+            if(peekChar('*')){ matchChar('*'); auto args=parseArgList(); if(args.size()!=2) throw runtime_error("* requires two arguments"); encodeCall("*",0x02,args); continue; }
+            if(peekChar('+')){ matchChar('+'); auto args=parseArgList(); if(args.size()!=2) throw runtime_error("+ requires two arguments");encodeCall("+",0x03,args); continue; }
+            if(peekChar('^')){ matchChar('^'); auto args=parseArgList(); if(args.size()!=2) throw runtime_error("+ requires two arguments");encodeCall("^",0x07,args); continue; }
+            if(peekChar('<')){ matchChar('<'); auto args=parseArgList(); if(args.size()!=2) throw runtime_error("+ requires two arguments");encodeCall("<",0x08,args); continue; }
+            if(peekChar('&')){ matchChar('&'); auto args=parseArgList(); if(args.size()!=1) throw runtime_error("& requires one argument");
                 args.push_back(0);
                 encodeCall("&",0x06,args); continue;
             }
-            if(s[i]=='"'){ parseString(prog.tape_pos); continue; }
+            if(s[i]=='"'){ parseString(); continue; }
             auto n=parseNumber();
             if(n.has_value()){
-                prog.tape[prog.tape_pos]=fromd((double)(int)*n).i;
-                prog.iscall[prog.tape_pos]=0;
-                prog.tape_pos++;
+                prog.emit(fromd(*n).i, 0);
                 continue;
             }
             throw runtime_error("Leftover expression - only strings and numbers can be placed here");
         }
         if(depth) throw runtime_error("Imbalanced brackets - not closed {");
-        STORAGE j = prog.tape_pos;
-        while(j < TAPE_SIZE){
-            prog.tape[j]=0;
-            prog.iscall[j]=0;
-            j++;
+    }
+};
+
+// Middle-end between Parser and VM. Cells that no instruction writes are constants. Assignments that are the only
+// writer of their target turn into aliases of their source (as ':=' does), instructions that read only constants
+// are folded into their result, and instructions whose result never reaches a stream are dropped. Removed
+// instructions keep their cells on the tape but lose their instruction tag.
+struct Optimizer {
+    Program& prog;
+    vector<pair<STORAGE,string>> listing; // instructions before optimization
+    unordered_map<STORAGE,const char*> removed;
+    STORAGE folded = 0, aliased = 0, dead = 0;
+    bool record = false; // keep the listing for dump()
+    unordered_map<STORAGE,string> names;
+    explicit Optimizer(Program& p, bool record_ = false):prog(p), record(record_) {}
+
+    string name(STORAGE c) const {
+        auto it = names.find(c);
+        if (it != names.end()) return it->second;
+        if (prog.iscall[c] == 2) return quoted(prog.str(prog.tape[c]));
+        if (prog.iscall[c] == 3) return "array("+to_string(prog.arrays[prog.tape[c]].length)+")";
+        std::ostringstream out;
+        out << fromi(prog.tape[c]).d;
+        return out.str();
+    }
+    string describe(STORAGE i) const {
+        const STORAGE* T = prog.tape.data;
+        STORAGE op = T[i];
+        if (op == 0x05) return name(T[i+1])+" = "+name(T[i+2]);
+        if (op == 0x04) {
+            for (auto& [stream, id] : prog.streamIds) if (id == T[i+2]-16) return stream+"| "+name(T[i+1]);
+        }
+        if (op >= 0x09 && op <= 0x0B) return name(i-1)+" :"+(op == 0x09 ? "sum" : op == 0x0A ? "min" : "max")+"("+name(T[i+1])+")";
+        const char* sym = op == 0x02 ? "*" : op == 0x03 ? "+" : op == 0x07 ? "^" : op == 0x08 ? "<" : "?";
+        return name(i-1)+" :"+sym+"("+name(T[i+1])+", "+name(T[i+2])+")";
+    }
+    void list() {
+        listing.clear();
+        names.clear();
+        for (auto& label : prog.labels) if (label.name != "__") names[label.tape_index] = label.name;
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1 || prog.iscall[i] == 4) listing.push_back({i, describe(i)});
+    }
+    void remove(STORAGE i, const char* why) { prog.iscall[i] = 0; removed[i] = why; }
+
+    // Cell -> instructions index in CSR form, for the given (cell, instruction) pairs.
+    static void index(STORAGE n, const vector<pair<STORAGE,STORAGE>>& pairs, vector<STORAGE>& start, vector<STORAGE>& items) {
+        start.assign(n+1, 0);
+        for (auto& [c, i] : pairs) start[c+1]++;
+        for (STORAGE k = 0; k < n; k++) start[k+1] += start[k];
+        items.resize(pairs.size());
+        vector<STORAGE> fill(start.begin(), start.end()-1);
+        for (auto& [c, i] : pairs) items[fill[c]++] = i;
+    }
+
+    // Strongly connected components of the cell graph given in CSR form (iterative Tarjan); two cells share a
+    // component exactly when each one's value feeds the other's.
+    static vector<STORAGE> components(STORAGE n, const vector<STORAGE>& start, const vector<STORAGE>& items) {
+        vector<STORAGE> index(n, -1), low(n), comp(n, -1), stack;
+        vector<pair<STORAGE,STORAGE>> call;
+        STORAGE counter = 0, ncomp = 0;
+        for (STORAGE root = 0; root < n; root++) if (index[root] < 0) {
+            index[root] = low[root] = counter++; stack.push_back(root); call.push_back({root, start[root]});
+            while (!call.empty()) {
+                auto& [v, next] = call.back();
+                if (next < start[v+1]) {
+                    STORAGE w = items[next++];
+                    if (index[w] < 0) { index[w] = low[w] = counter++; stack.push_back(w); call.push_back({w, start[w]}); }
+                    else if (comp[w] < 0) low[v] = min(low[v], index[w]);
+                    continue;
+                }
+                STORAGE done = v;
+                call.pop_back();
+                if (!call.empty()) low[call.back().first] = min(low[call.back().first], low[done]);
+                if (low[done] != index[done]) continue;
+                for (STORAGE w = -1; w != done;) { w = stack.back(); stack.pop_back(); comp[w] = ncomp; }
+                ncomp++;
+            }
+        }
+        return comp;
+    }
+
+    void run() {
+        if (record) list();
+        STORAGE* T = prog.tape.data;
+        STORAGE n = prog.tape_pos;
+        vector<STORAGE> ops, writes(n, 0), alias(n);
+        vector<STORAGE> arrayOps; // never removed; they only count as writers and readers
+        for (STORAGE i = 0; i < n; i++) if (prog.iscall[i] == 1) ops.push_back(i); else if (prog.iscall[i] == 4) arrayOps.push_back(i);
+        auto live = [&](STORAGE i) { return prog.iscall[i] == 1; };
+        auto dst = [&](STORAGE i) { STORAGE z, r; return evaluate(T, i, z, r) ? z : -1; };
+        for (STORAGE i : ops) if (dst(i) >= 0) writes[dst(i)]++;
+        for (STORAGE i : arrayOps) writes[T[i] == 0x05 ? T[i+1] : i-1]++;
+
+        // copy propagation: lhs = rhs makes lhs another name for rhs, which drops the value lhs starts with. That is
+        // only safe when both start equal, or when lhs does not feed back into rhs (so its start value cannot survive
+        // into the fixed point); otherwise the assignment is kept.
+        vector<pair<STORAGE,STORAGE>> edges; // cell -> cells read by its writers
+        for (STORAGE i : ops) if (dst(i) >= 0) {
+            auto [a, b] = sources(T, i);
+            if (a >= 0) edges.push_back({dst(i), a});
+            if (b >= 0) edges.push_back({dst(i), b});
+        }
+        for (STORAGE i : arrayOps) {
+            STORAGE z = T[i] == 0x05 ? T[i+1] : i-1;
+            if (T[i] != 0x05) edges.push_back({z, T[i+1]});
+            edges.push_back({z, T[i+2]});
+        }
+        vector<STORAGE> edgeStart, edgeItems;
+        index(n, edges, edgeStart, edgeItems);
+        vector<STORAGE> comp = components(n, edgeStart, edgeItems);
+        iota(alias.begin(), alias.end(), 0);
+        auto find = [&](STORAGE c) { while (alias[c] != c) { alias[c] = alias[alias[c]]; c = alias[c]; } return c; };
+        for (STORAGE i : ops) if (T[i] == 0x05) {
+            STORAGE lhs = T[i+1], rhs = find(T[i+2]);
+            if (writes[lhs] != 1 || rhs == lhs) continue;
+            if (T[lhs] != T[rhs] && comp[lhs] == comp[T[i+2]]) continue;
+            alias[lhs] = rhs;
+            writes[lhs] = 0;
+            remove(i, "aliased");
+            aliased++;
+        }
+        for (STORAGE i : ops) if (live(i)) {
+            if (T[i] == 0x05 || T[i] == 0x04) T[i+2-(T[i]==0x04)] = find(T[i+2-(T[i]==0x04)]);
+            else if (sources(T, i).first >= 0) { T[i+1] = find(T[i+1]); T[i+2] = find(T[i+2]); }
+        }
+        for (STORAGE i : arrayOps) { if (T[i] != 0x05) T[i+1] = find(T[i+1]); T[i+2] = find(T[i+2]); }
+        for (auto& label : prog.labels) if (label.tape_index < n) label.tape_index = find(label.tape_index);
+
+        // constant folding, following readers of every cell that becomes constant
+        vector<pair<STORAGE,STORAGE>> reads;
+        for (STORAGE i : ops) if (live(i)) {
+            auto [a, b] = sources(T, i);
+            if (a >= 0) reads.push_back({a, i});
+            if (b >= 0 && b != a) reads.push_back({b, i});
+        }
+        vector<STORAGE> readerStart, readers;
+        index(n, reads, readerStart, readers);
+        vector<STORAGE> work;
+        for (STORAGE i : ops) if (live(i) && sources(T, i).first >= 0) work.push_back(i);
+        while (!work.empty()) {
+            STORAGE i = work.back(); work.pop_back();
+            if (!live(i)) continue;
+            auto [a, b] = sources(T, i);
+            if (writes[a] || (b >= 0 && writes[b])) continue;
+            STORAGE z, r;
+            evaluate(T, i, z, r);
+            if (writes[z] != 1) continue;
+            T[z] = r;
+            writes[z] = 0;
+            remove(i, "folded");
+            folded++;
+            for (STORAGE k = readerStart[z]; k < readerStart[z+1]; k++) work.push_back(readers[k]);
+        }
+
+        // dead instructions: everything that does not feed a stream
+        vector<pair<STORAGE,STORAGE>> writePairs;
+        for (STORAGE i : ops) if (live(i) && dst(i) >= 0) writePairs.push_back({dst(i), i});
+        vector<STORAGE> writerStart, writers, stack;
+        index(n, writePairs, writerStart, writers);
+        vector<TAG> needed(n, 0);
+        auto need = [&](STORAGE c) { if (c >= 0 && !needed[c]) { needed[c] = 1; stack.push_back(c); } };
+        for (STORAGE i : ops) if (live(i) && T[i] == 0x04) need(T[i+1]);
+        for (STORAGE i : arrayOps) { need(T[i+1]); need(T[i+2]); }
+        while (!stack.empty()) {
+            STORAGE c = stack.back(); stack.pop_back();
+            for (STORAGE k = writerStart[c]; k < writerStart[c+1]; k++) { auto [a, b] = sources(T, writers[k]); need(a); need(b); }
+        }
+        for (STORAGE i : ops) if (live(i) && dst(i) >= 0 && !needed[dst(i)]) { remove(i, "dead"); dead++; }
+    }
+
+    string dump() const {
+        std::ostringstream out;
+        for (auto& [i, text] : listing) {
+            auto it = removed.find(i);
+            out << (it == removed.end() ? "kept" : it->second) << "\t@" << i << "\t" << text << "\n";
+        }
+        out << "; " << listing.size() << " instructions: " << listing.size()-removed.size() << " kept, "
+            << folded << " folded, " << aliased << " aliased, " << dead << " dead\n";
+        return out.str();
+    }
+};
+
+
+// Precompiled image written by gt -c: a header page, then the tape and the tags (each padded to whole pages, so
+// that loading maps them copy-on-write with no parsing or copying), then labels, stream names and the string pool.
+struct Image {
+    static const uint32_t version = 4;
+    struct Header {
+        char magic[8];
+        uint32_t version, cellBytes;
+        int64_t cells, tapeOffset, tagsOffset, symbolsOffset, symbolsBytes, nextStreamId, arraysOffset, arrayCells;
+    };
+    static size_t page() { return sysconf(_SC_PAGESIZE); }
+    static size_t pad(size_t n) { return (n+page()-1)/page()*page(); }
+
+    static bool is(const string& path) {
+        char magic[8] = {};
+        ifstream f(path, ios::binary);
+        f.read(magic, 8);
+        return f && memcmp(magic, "GOTOPE\0\0", 8) == 0;
+    }
+
+    static void write(const Program& prog, const string& path) {
+        string symbols;
+        auto put = [&](const void* data, size_t n) { symbols.append((const char*)data, n); };
+        auto putString = [&](const string& str) { uint32_t n = str.size(); put(&n, 4); put(str.data(), n); };
+        uint64_t count = prog.labels.size();
+        put(&count, 8);
+        for (auto& label : prog.labels) { putString(label.name); put(&label.tape_index, 8); put(&label.depth, 8); put(&label.line, 8); }
+        count = prog.streamIds.size();
+        put(&count, 8);
+        for (auto& [name, id] : prog.streamIds) { putString(name); int32_t v = id; put(&v, 4); }
+        count = prog.strings.size();
+        put(&count, 8);
+        put(prog.strings.data(), count);
+        count = prog.arrays.size();
+        put(&count, 8);
+        for (auto& a : prog.arrays) { put(&a.offset, 8); put(&a.length, 8); }
+
+        Header h{};
+        memcpy(h.magic, "GOTOPE\0\0", 8);
+        h.version = version;
+        h.cellBytes = sizeof(STORAGE);
+        h.cells = prog.tape_pos;
+        h.tapeOffset = pad(sizeof(Header));
+        h.tagsOffset = h.tapeOffset+pad(prog.tape_pos*sizeof(STORAGE));
+        h.arraysOffset = h.tagsOffset+pad(prog.tape_pos*sizeof(TAG));
+        h.arrayCells = prog.arrayCells;
+        h.symbolsOffset = h.arraysOffset+pad(prog.arrayCells*sizeof(double));
+        h.symbolsBytes = symbols.size();
+        h.nextStreamId = prog.nextStreamId;
+        ofstream f(path, ios::binary|ios::trunc);
+        if (!f) throw runtime_error("Cannot open "+path);
+        string zeros(page(), '\0');
+        f.write((const char*)&h, sizeof(h));
+        f.write(zeros.data(), h.tapeOffset-sizeof(h));
+        f.write((const char*)prog.tape.data, prog.tape_pos*sizeof(STORAGE));
+        f.write(zeros.data(), h.tagsOffset-h.tapeOffset-prog.tape_pos*sizeof(STORAGE));
+        f.write((const char*)prog.iscall.data, prog.tape_pos*sizeof(TAG));
+        f.write(zeros.data(), h.arraysOffset-h.tagsOffset-prog.tape_pos*sizeof(TAG));
+        f.write((const char*)prog.arrayData.data, prog.arrayCells*sizeof(double));
+        f.write(zeros.data(), h.symbolsOffset-h.arraysOffset-prog.arrayCells*sizeof(double));
+        f.write(symbols.data(), symbols.size());
+        if (!f) throw runtime_error("Cannot write "+path);
+    }
+
+    // lastLabel is only needed while parsing and is not restored.
+    static Program load(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Cannot open "+path);
+        Header h;
+        if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, "GOTOPE\0\0", 8)) { close(fd); throw runtime_error("Not a gotope image: "+path); }
+        if (h.version != version || h.cellBytes != sizeof(STORAGE)) { close(fd); throw runtime_error("Unsupported image version, recompile with gt -c: "+path); }
+        Program prog;
+        prog.tape_pos = h.cells;
+        prog.nextStreamId = h.nextStreamId;
+        try {
+            prog.tape.mapPrivate(fd, h.tapeOffset, h.cells);
+            prog.iscall.mapPrivate(fd, h.tagsOffset, h.cells);
+            if (h.arrayCells) prog.arrayData.mapPrivate(fd, h.arraysOffset, h.arrayCells);
+            prog.arrayCells = h.arrayCells;
+        } catch (...) { close(fd); throw; }
+        string symbols(h.symbolsBytes, '\0');
+        bool ok = pread(fd, symbols.data(), h.symbolsBytes, h.symbolsOffset) == (ssize_t)h.symbolsBytes;
+        close(fd);
+        if (!ok) throw runtime_error("Truncated image: "+path);
+        size_t at = 0;
+        auto get = [&](void* data, size_t n) { if (at+n > symbols.size()) throw runtime_error("Truncated image: "+path); memcpy(data, symbols.data()+at, n); at += n; };
+        auto getString = [&]() { uint32_t n; get(&n, 4); if (at+n > symbols.size()) throw runtime_error("Truncated image: "+path); string str = symbols.substr(at, n); at += n; return str; };
+        uint64_t count;
+        get(&count, 8);
+        prog.labels.reserve(count);
+        for (uint64_t k = 0; k < count; k++) { Label label; label.name = getString(); get(&label.tape_index, 8); get(&label.depth, 8); get(&label.line, 8); prog.labels.push_back(std::move(label)); }
+        get(&count, 8);
+        for (uint64_t k = 0; k < count; k++) { string name = getString(); int32_t id; get(&id, 4); prog.streamIds[name] = id; }
+        get(&count, 8);
+        prog.strings.resize(count);
+        get(prog.strings.data(), count);
+        get(&count, 8);
+        prog.arrays.resize(count);
+        for (auto& a : prog.arrays) { get(&a.offset, 8); get(&a.length, 8); a.version = 0; }
+        return prog;
+    }
+};
+
+// Ahead-of-time backend: writes the optimized tape as a standalone C++ program. Every instruction becomes one
+// straight-line statement with constant tape indices, executed in tape order like --mode=seq, and main() repeats
+// the fixed-point loop and console refresh of VM::run. Only the out stream is emitted, so programs with other
+// streams are rejected rather than losing their sinks.
+struct Emitter {
+    const Program& prog;
+    STORAGE maxloops;
+    static const STORAGE perFunction = 4096; // keeps each generated function small enough for the compiler
+    Emitter(const Program& p, STORAGE maxloops_):prog(p), maxloops(maxloops_) {}
+
+    void write(ostream& out) const {
+        const STORAGE* T = prog.tape.data;
+        if (!prog.arrays.empty()) throw runtime_error("--emit-c does not support arrays");
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1 && T[i] == 0x04 && T[i+2]-16 != 0)
+            throw runtime_error("--emit-c only supports the out stream");
+        out << "// Generated by gt --emit-c\n#include <cstdio>\n#include <cstdint>\n#include <cstring>\n#include <cmath>\n#include <chrono>\n#include <string>\n#include <unistd.h>\n";
+        out << "static inline double D(int64_t v){ double d; memcpy(&d,&v,8); return d; }\n";
+        out << "static inline int64_t I(double d){ int64_t v; memcpy(&v,&d,8); return v; }\n";
+        bool tolerant = absTol != 0 || relTol != 0;
+        if (tolerant) { // same test as differs(), with --atol/--rtol baked in
+            char tol[128];
+            snprintf(tol, sizeof(tol), "%.17g+%.17g", absTol, relTol);
+            out << "static inline bool differs(int64_t o,int64_t r){ double a=D(o), b=D(r); return !(fabs(a-b) <= "
+                << tol << "*fmax(fabs(a),fabs(b))); }\n";
+        }
+        out << "static int64_t T[" << max<STORAGE>(prog.tape_pos, 1) << "] = {";
+        for (STORAGE k = 0; k < prog.tape_pos; k++) {
+            out << (k == 0 ? "\n" : k % 8 ? "," : ",\n");
+            if (T[k] == INT64_MIN) out << "(-9223372036854775807LL-1)"; else out << T[k] << "LL";
+        }
+        out << "\n};\n";
+        vector<STORAGE> ops;
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1) {
+            STORAGE zpos, r;
+            if (evaluate(T, i, zpos, r)) ops.push_back(i);
+        }
+        STORAGE functions = (ops.size()+perFunction-1)/perFunction;
+        for (STORAGE f = 0; f < functions; f++) {
+            out << "static bool step" << f << "(){\n bool m=false; int64_t r;\n";
+            for (size_t k = f*perFunction; k < ops.size() && k < (size_t)(f+1)*perFunction; k++) {
+                STORAGE i = ops[k], op = T[i], a = T[i+1], b = T[i+2], z = i-1;
+                if (op == 0x05) { z = a; out << " r=T[" << b << "];"; }
+                else if (op == 0x02) out << " r=I(D(T[" << a << "])*D(T[" << b << "]));";
+                else if (op == 0x03) out << " r=I(D(T[" << a << "])+D(T[" << b << "]));";
+                else if (op == 0x07) out << " r=I(pow(D(T[" << a << "]),D(T[" << b << "])));";
+                else out << " r=I(D(T[" << a << "])<D(T[" << b << "])?1.0:-1.0);";
+                if (tolerant) out << " if(T[" << z << "]!=r){m=differs(T[" << z << "],r)||m;T[" << z << "]=r;}\n";
+                else out << " if(T[" << z << "]!=r){T[" << z << "]=r;m=true;}\n";
+            }
+            out << " return m;\n}\n";
         }
+        out << "static bool step(){\n bool m=false;\n";
+        for (STORAGE f = 0; f < functions; f++) out << " m=step" << f << "()||m;\n";
+        out << " return m;\n}\n";
+        out << "static void show(std::string& s){\n char buf[64];\n";
+        for (STORAGE i = 0; i < prog.tape_pos; i++) if (prog.iscall[i] == 1 && T[i] == 0x04 && T[i+2]-16 == 0) {
+            STORAGE loc = T[i+1];
+            if (prog.iscall[loc] == 2) out << " s+=" << quoted(prog.str(T[loc])) << ";\n";
+            else out << " snprintf(buf,sizeof(buf),\"%f\",D(T[" << loc << "])); s+=buf;\n";
+        }
+        out << "}\n";
+        out << "int main(){\n"
+               " using clock = std::chrono::high_resolution_clock;\n"
+               " auto start = clock::now();\n"
+               " const long long maxloops = " << maxloops << "LL;\n"
+               " const bool tty = isatty(1);\n"
+               " if(tty) fputs(\"\\033[2J\\n\", stdout);\n"
+               " bool running = true;\n"
+               " long long loops = 0;\n"
+               " while(running){\n"
+               "  running = step();\n"
+               "  loops++;\n"
+               "  if(loops >= maxloops) running = false;\n"
+               "  if(!running || (tty && loops%1000==0)){\n"
+               "   std::string s = tty ? \"\\033[2J\\033[H\" : \"\";\n"
+               "   show(s);\n"
+               "   long long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now()-start).count();\n"
+               "   char buf[128];\n"
+               "   if(loops >= maxloops) snprintf(buf,sizeof(buf),\"\\nExceeded max loops (%lld loops, %lldms)\\n\",maxloops,elapsed);\n"
+               "   else if(running) snprintf(buf,sizeof(buf),\"\\nRunning (terminate with ctrl+c)\\n\");\n"
+               "   else snprintf(buf,sizeof(buf),\"\\nDone (%lld native loops, %lldms)\\n\",loops,elapsed);\n"
+               "   s+=buf;\n"
+               "   fputs(s.c_str(), stdout);\n"
+               "   fflush(stdout);\n"
+               "  }\n"
+               " }\n"
+               " return 0;\n"
+               "}\n";
     }
 };
 
+// Compiles the emitted program with $CXX (default g++) and checks that its console output matches --mode=seq,
+// ignoring timings and the mode name in the final line.
+static bool checkNative(const string& src, bool optimize, STORAGE maxloops) {
+    auto normalize = [](const string& text) {
+        return regex_replace(regex_replace(text, regex("[0-9]+ms"), "ms"), regex("\\(([0-9]+) [a-z]+ loops"), "($1 loops");
+    };
+    Parser p(src); p.parse();
+    if (optimize) Optimizer(p.prog).run();
+    char dir[] = "/tmp/gt-native-XXXXXX";
+    if (!mkdtemp(dir)) throw runtime_error("Cannot create a temporary directory");
+    string base = string(dir)+"/prog";
+    { ofstream f(base+".cpp"); Emitter(p.prog, maxloops).write(f); }
+    const char* cxx = getenv("CXX");
+    string compile = string(cxx ? cxx : "g++")+" -O2 -fopenmp "+base+".cpp -o "+base;
+    if (system(compile.c_str())) throw runtime_error("Native compilation failed: "+compile);
+    string native;
+    FILE* pipe = popen(base.c_str(), "r");
+    if (!pipe) throw runtime_error("Cannot run "+base);
+    char buf[4096];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), pipe)) > 0;) native.append(buf, n);
+    pclose(pipe);
+    std::ostringstream interpreted;
+    VM vm(std::move(p.prog)); vm.mode = "seq"; vm.maxloops = maxloops; vm.checkOscillation = false; vm.console = &interpreted; vm.run();
+    remove((base+".cpp").c_str()); remove(base.c_str()); rmdir(dir);
+    bool same = normalize(native) == normalize(interpreted.str());
+    cout << (same ? "Native output matches the interpreter\n" : "Native output differs from the interpreter\n");
+    if (!same) cout << "--- interpreter\n" << interpreted.str() << "\n--- native\n" << native << "\n";
+    return same;
+}
+
+// Synthetic program of about `lines` lines: a chain of scopes, each with a nested scope, that read their
+// own members, the previous scope and the first scope through dotted names.
+static string generateScopes(size_t lines) {
+    std::ostringstream out;
+    out << "one:=1\n";
+    size_t k = 0;
+    for (size_t n = 2; n+8 <= lines || k == 0; n += 8, k++) {
+        out << "s" << k << " {\n  x:=" << k%10 << "\n  inner {\n    y:+(x,one)\n  }\n";
+        out << "  z:*(inner.y," << (k ? "s"+to_string(k-1)+".z" : string("one")) << ")\n  w:+(z,s0.x)\n}\n";
+    }
+    out << "out| s" << k-1 << ".z\n";
+    return out.str();
+}
+
+// One scope nested inside the previous one, about lines/6 deep. Each level reads a cell through a small sibling
+// scope, since dotted names only reach labels at least as deep as the reference.
+static string generateDeep(size_t lines) {
+    std::ostringstream out;
+    size_t depth = max<size_t>(lines/6, 1);
+    out << "one:=1\n";
+    for (size_t k = 0; k < depth; k++) out << "d" << k << " {\ne" << k << " {\ny" << k << ":+(one,one)\n}\nx" << k << ":+(one,e" << k << ".y" << k << ")\n";
+    for (size_t k = 0; k < depth; k++) out << "}\n";
+    out << "out| d0.x" << depth-1 << "\n";
+    return out.str();
+}
+
+// Parse times for generated programs of lines/8 up to lines lines, for sibling scope chains and for one deeply
+// nested scope; a flat ns/line column means linear parsing.
+static void benchParse(size_t lines) {
+    cout << "shape\tlines\tms\tns/line\n";
+    for (const char* shape : {"chain", "deep"})
+        for (size_t n = max<size_t>(lines/8, 8); n <= lines; n *= 2) {
+            string src = shape[0] == 'c' ? generateScopes(n) : generateDeep(n);
+            auto start = chrono::high_resolution_clock::now();
+            Parser p(src); p.parse();
+            double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now()-start).count();
+            cout << shape << "\t" << n << "\t" << ms << "\t" << ms*1e6/n << "\n";
+        }
+}
+
+// Benchmark workloads, each about `size` instructions.
+static string generateChain(size_t size) {  // every cell reads the previous one
+    std::ostringstream out;
+    out << "one:=1\nx0:=1\n";
+    for (size_t k = 1; k < size; k++) out << "x" << k << ":+(x" << k-1 << ",one)\n";
+    out << "out| x" << size-1 << "\n";
+    return out.str();
+}
+
+static string generateFanout(size_t size) {  // independent cells reading one shared source
+    std::ostringstream out;
+    out << "x:=2\n";
+    for (size_t k = 0; k < size; k++) out << "y" << k << ":*(x," << k%7+1 << ")\n";
+    out << "out| y0\n";
+    return out.str();
+}
+
+static string generateCycles(size_t size) {  // counters stepping to a limit, like the iter divisor search
+    std::ostringstream out;
+    out << "one:=1\nhalf:=0.5\nlimit:=100\n";
+    for (size_t k = 0; k < max<size_t>(size/4, 1); k++)
+        out << "c" << k << " {\n  d:=" << k%50 << "\n  below:<(d,limit)\n  up:+(below,one)\n  inc:*(up,half)\n  next:+(d,inc)\n  d = next\n}\n";
+    out << "out| c0.d\n";
+    return out.str();
+}
+
+static string generateStrings(size_t size) {  // string-heavy stream output
+    std::ostringstream out;
+    out << "one:=1\n";
+    for (size_t k = 0; k < max<size_t>(size/2, 1); k++) out << "v" << k << ":+(one," << k << ")\nout| \"value number " << k << " is \"\nout| v" << k << "\n";
+    return out.str();
+}
+
+// --bench: parse time, loops/s, ns per executed instruction and pool scaling for each workload, as JSON. The
+// programs run unoptimized so the engine sees the generated structure; optimize_ms, kept and the optimized_ fields
+// show what the Optimizer does; folding may save the first loop, but optimized_loops should never exceed loops.
+static void bench(size_t size, int threads) {
+    using clock = chrono::steady_clock;
+    auto since = [](clock::time_point t) { return chrono::duration<double, milli>(clock::now()-t).count(); };
+    vector<pair<string,string>> workloads = {
+        {"chain", generateChain(size)}, {"fanout", generateFanout(size)}, {"cycles", generateCycles(size)},
+        {"strings", generateStrings(size)}, {"scopes", generateScopes(size)}, {"deep", generateDeep(size)}};
+    cout << "{\"size\": " << size << ", \"threads\": " << threads << ", \"workloads\": [\n";
+    for (size_t w = 0; w < workloads.size(); w++) {
+        auto& [name, src] = workloads[w];
+        auto start = clock::now();
+        Parser p(src); p.parse();
+        double parseMs = since(start);
+        STORAGE instructions = 0, cells = p.prog.tape_pos;
+        for (STORAGE i = 0; i < cells; i++) instructions += p.prog.iscall[i] == 1;
+        Parser q(src); q.parse();
+        Optimizer o(q.prog);
+        start = clock::now();
+        o.run();
+        double optimizeMs = since(start);
+        STORAGE kept = 0;
+        for (STORAGE i = 0; i < q.prog.tape_pos; i++) kept += q.prog.iscall[i] == 1;
+        VM optimized(std::move(q.prog)); optimized.quiet = true;
+        start = clock::now();
+        optimized.run();
+        double optimizedMs = since(start);
+
+        std::ostringstream sink;
+        VM vm(std::move(p.prog)); vm.console = &sink; vm.tty = 0; vm.refresh = 0;
+        start = clock::now();
+        vm.run();
+        double runMs = since(start);
+        cout << " {\"name\": \"" << name << "\", \"lines\": " << count(src.begin(), src.end(), '\n') << ", \"cells\": " << cells
+             << ", \"instructions\": " << instructions << ", \"parse_ms\": " << parseMs << ", \"parse_ns_per_line\": "
+             << parseMs*1e6/max<size_t>(count(src.begin(), src.end(), '\n'), 1) << ", \"optimize_ms\": " << optimizeMs << ", \"kept\": " << kept
+             << ", \"optimized_loops\": " << optimized.loops << ", \"optimized_run_ms\": " << optimizedMs
+             << ",\n  \"loops\": " << vm.loops << ", \"run_ms\": " << runMs << ", \"loops_per_sec\": " << vm.loops*1e3/runMs
+             << ", \"ns_per_instruction\": " << runMs*1e6/max<double>(instructions*vm.loops, 1) << ",\n  \"scaling\": [";
+        vector<int> counts;
+        for (int t = 1; t < threads; t *= 2) counts.push_back(t);
+        counts.push_back(threads);
+        for (int t : counts) {
+            Parser r(src); r.parse();
+            VM pool(std::move(r.prog)); pool.mode = "pool"; pool.threads = t; pool.quiet = true;
+            start = clock::now();
+            pool.run();
+            double ms = since(start);
+            cout << (t > 1 ? ", " : "") << "{\"threads\": " << t << ", \"loops\": " << pool.loops << ", \"ms\": " << ms << "}";
+        }
+        cout << "]}" << (w+1 < workloads.size() ? "," : "") << "\n";
+    }
+    cout << "]}\n";
+}
+
+struct Options {
+    string path;
+    string tapeFile; // --tape-file=path backs the running tape with a shared file mapping
+    string mode = "sweep"; // --mode=sweep|seq|jacobi|levels|worklist|simd|pool|shard
+    string simd = "auto"; // --simd=auto|scalar|avx2|avx512 kernel for --mode=simd
+    int threads = max(1u, thread::hardware_concurrency()); // --threads=N workers for --mode=pool
+    int processes = max(1u, thread::hardware_concurrency()); // --processes=N workers for --mode=shard
+    size_t serialBelow = 4096; // --serial-below=N instructions run without waking the pool
+    bool scaling = false; // --scaling reports --mode=pool run times from 1 to --threads workers
+    bool optimize = true; // --no-opt skips the Optimizer
+    bool dumpIR = false; // --dump-ir lists the instructions and what the Optimizer removed, then exits
+    string emitC; // --emit-c out.c writes a standalone C++ program instead of running
+    bool checkNative = false; // --check-native compiles the emitted program and compares it with the interpreter
+    bool compile = false; // -c writes a precompiled image to -o (default: the source path with .gto) instead of running
+    string output;
+    int tty = -1; // --plain never writes terminal escape codes
+    int refresh = 100; // --refresh=MS between stream refreshes, 0 for output at the end only
+    map<string,string> sinks; // --stream=name:path binds a named stream to a file, or to a command with name:|cmd
+    string batch; // --batch inputs.csv runs the program once per row, with the named cells set from the columns
+    STORAGE maxloops = 100000; // --max-loops=N stops a run that has not settled after N loops
+    double atol = 0, rtol = 0; // --atol=X --rtol=X: changes within atol + rtol*|value| count as settled
+    bool checkOscillation = true; // --no-oscillation-check keeps running repeating states up to --max-loops
+    bool profile = false; // --profile reports opcode counts, the convergence curve, hot cells and thread time
+    string profileJson; // --profile-json=path also writes the profile as JSON
+    size_t bench = 0; // --bench[=SIZE] runs the generated benchmark workloads of about SIZE instructions, as JSON
+    size_t benchParse = 0; // --bench-parse=LINES times parsing of generated scoped programs up to LINES lines
+    void parse(int argc, char** argv) {
+        for(int a=1;a<argc;a++){
+            string arg = argv[a];
+            if(arg.rfind("--tape-file=",0)==0) tapeFile = arg.substr(12);
+            else if(arg.rfind("--mode=",0)==0) mode = arg.substr(7);
+            else if(arg.rfind("--simd=",0)==0) simd = arg.substr(7);
+            else if(arg.rfind("--threads=",0)==0) threads = stoi(arg.substr(10));
+            else if(arg.rfind("--processes=",0)==0) processes = stoi(arg.substr(12));
+            else if(arg.rfind("--serial-below=",0)==0) serialBelow = stoull(arg.substr(15));
+            else if(arg == "--scaling") scaling = true;
+            else if(arg == "--no-opt") optimize = false;
+            else if(arg == "--dump-ir") dumpIR = true;
+            else if(arg == "--emit-c" && a+1<argc) emitC = argv[++a];
+            else if(arg == "--check-native") checkNative = true;
+            else if(arg == "-c") compile = true;
+            else if(arg == "--plain") tty = 0;
+            else if(arg.rfind("--refresh=",0)==0) refresh = stoi(arg.substr(10));
+            else if(arg.rfind("--stream=",0)==0 && arg.find(':')!=string::npos) sinks[arg.substr(9, arg.find(':')-9)] = arg.substr(arg.find(':')+1);
+            else if(arg.rfind("--bench-parse=",0)==0) benchParse = stoull(arg.substr(14));
+            else if(arg == "--bench") bench = 100000;
+            else if(arg.rfind("--bench=",0)==0) bench = max<size_t>(stoull(arg.substr(8)), 2);
+            else if(arg == "-o" && a+1<argc) output = argv[++a];
+            else if(arg == "--batch" && a+1<argc) batch = argv[++a];
+            else if(arg.rfind("--max-loops=",0)==0) maxloops = stoll(arg.substr(12));
+            else if(arg.rfind("--atol=",0)==0) atol = stod(arg.substr(7));
+            else if(arg.rfind("--rtol=",0)==0) rtol = stod(arg.substr(7));
+            else if(arg == "--no-oscillation-check") checkOscillation = false;
+            else if(arg == "--profile") profile = true;
+            else if(arg.rfind("--profile-json=",0)==0) { profile = true; profileJson = arg.substr(15); }
+            else if(arg.rfind("-",0)==0) throw runtime_error("Unknown option: "+arg);
+            else path = arg;
+        }
+    }
+};
 
 int main(int argc,char**argv){
+    Options opt;
+    try{opt.parse(argc, argv);}
+    catch(const exception&e){cerr<<"Error: "<<e.what()<<"\n"; return 1;}
+    if(opt.maxloops < 1 || opt.atol < 0 || opt.rtol < 0){ cerr<<"Error: --max-loops must be positive and tolerances non-negative\n"; return 1; }
+    absTol = opt.atol; relTol = opt.rtol;
+    if(opt.benchParse){ benchParse(opt.benchParse); return 0; }
+    if(opt.bench){ bench(opt.bench, opt.threads); return 0; }
+    bool image = !opt.path.empty() && Image::is(opt.path);
     string src;
-    if(argc>1){
-        ifstream f(argv[1]);
-        if(!f){ cerr<<"Cannot open "<<argv[1]<<"\n"; return 1;}
+    if(image);
+    else if(!opt.path.empty()){
+        ifstream f(opt.path);
+        if(!f){ cerr<<"Cannot open "<<opt.path<<"\n"; return 1;}
         src.assign((istreambuf_iterator<char>(f)),{});
     } else src.assign((istreambuf_iterator<char>(cin)),{});
-    try{Parser p(src); p.parse(); VM vm(p.prog); vm.run();}
+    try{
+        if(image && (opt.checkNative || opt.scaling || opt.dumpIR || opt.compile || !opt.batch.empty())) throw runtime_error("This option needs a source file, not an image");
+        if(opt.checkNative) return checkNative(src, opt.optimize, opt.maxloops) ? 0 : 1;
+        if(opt.scaling){
+            double base = 0;
+            cout << "threads\tloops\tms\tspeedup\n";
+            for(int t=1;t<=opt.threads;t++){
+                Parser p(src); p.parse();
+                if(opt.optimize) Optimizer(p.prog).run();
+                VM vm(std::move(p.prog)); vm.mode = "pool"; vm.threads = t; vm.serialBelow = opt.serialBelow; vm.quiet = true;
+                vm.maxloops = opt.maxloops; vm.checkOscillation = opt.checkOscillation;
+                auto start = chrono::high_resolution_clock::now();
+                vm.run();
+                double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now()-start).count();
+                if(t==1) base = ms;
+                cout << t << "\t" << vm.loops << "\t" << ms << "\t" << base/ms << "\n";
+            }
+            return 0;
+        }
+        Parser p(src);
+        if(image) p.prog = Image::load(opt.path);
+        else p.parse();
+        if(!opt.batch.empty()){
+            auto start = chrono::steady_clock::now();
+            Batch b(p.prog);
+            b.maxloops = opt.maxloops;
+            b.read(opt.batch);
+            for(auto& name : b.names) b.inputs.push_back(p.resolveScoped(name));
+            b.build();
+            b.run();
+            b.write(cout);
+            size_t settled = count_if(b.converged.begin(), b.converged.end(), [](STORAGE l){ return l >= 0; });
+            cerr << "Done (" << b.rows.size() << " instances, " << settled << " converged, "
+                 << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-start).count() << "ms)\n";
+            return 0;
+        }
+        Optimizer o(p.prog, opt.dumpIR);
+        if(opt.optimize && !image) o.run();
+        if(opt.dumpIR){ if(!opt.optimize) o.list(); cout << o.dump(); return 0; }
+        if(opt.compile){
+            string out = opt.output;
+            if(out.empty()){
+                size_t dot = opt.path.rfind('.'), slash = opt.path.rfind('/');
+                out = opt.path.empty() ? "a.gto" : opt.path.substr(0, dot == string::npos || (slash != string::npos && dot < slash) ? opt.path.size() : dot)+".gto";
+            }
+            Image::write(p.prog, out);
+            return 0;
+        }
+        if(!opt.emitC.empty()){
+            ofstream f(opt.emitC);
+            if(!f){ cerr<<"Cannot open "<<opt.emitC<<"\n"; return 1;}
+            Emitter(p.prog, opt.maxloops).write(f);
+            return 0;
+        }
+        if(!opt.tapeFile.empty()) p.prog.mapFile(opt.tapeFile);
+        VM vm(std::move(p.prog)); vm.mode = opt.mode; vm.simd = opt.simd; vm.threads = opt.threads; vm.serialBelow = opt.serialBelow;
+        vm.tty = opt.tty; vm.refresh = opt.refresh; vm.sinks = opt.sinks;
+        vm.maxloops = opt.maxloops; vm.checkOscillation = opt.checkOscillation;
+        vm.profile = opt.profile; vm.profileJson = opt.profileJson; vm.processes = opt.processes; vm.run();
+    }
     catch(const exception&e){cerr<<"Error: "<<e.what()<<"\n"; return 1;}
     return 0;
 }
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Runs every tests/*.gt with the flags on its "// args:" line and compares the output with the .out file next
+# to it, ignoring run times. Usage: tests/run.sh [path to gt, default ./gt]
+gt=${1:-./gt}
+dir=$(dirname "$0")
+failed=0
+for src in "$dir"/*.gt; do
+    args=$(sed -n 's|^// args: ||p' "$src")
+    if "$gt" --plain $args "$src" 2>&1 | sed 's/, [0-9.]*ms)/)/' | diff -u "${src%.gt}.out" - >/dev/null; then
+        echo "ok   $src"
+    else
+        echo "FAIL $src"; failed=1
+    fi
+done
+exit $failed